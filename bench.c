@@ -0,0 +1,550 @@
+/**
+ * \file bench.c
+ *
+ * \brief Benchmarks for the hot paths of the diceware module.
+ *
+ * Builds a scratch SQLite database and compact word list from a word list,
+ * then times importing, opening, drawing random slots, looking up words and
+ * generating passphrases. Each result is one record giving the time per word,
+ * passphrases per second, random bytes fetched and the peak resident set size
+ * so far, printed as CSV (the default) or JSON so results can be compared
+ * between versions.
+ */
+
+#include <err.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "diceware.h"
+
+#define USAGE_STRING \
+	"usage: %s [-b <batch,...>] [-c <count>] [-f csv|json] [-h] " \
+	"[-j <threads,...>] [-n <num>] [-r <reps>] [-w <wordlist>]\n"
+
+/**
+ * Largest number of entries in a comma-separated list of batch sizes or
+ * thread counts.
+ */
+#define MAX_LIST 16
+
+/**
+ * Output formats for the results.
+ */
+enum format
+{
+    FORMAT_CSV,
+    FORMAT_JSON,
+};
+
+/**
+ * A single benchmark result.
+ */
+struct result
+{
+    const char *name;       /**< What was measured. */
+    const char *backend;    /**< Where the words came from. */
+    unsigned threads;       /**< Number of generator threads. */
+    size_t batch;           /**< Passphrases per call. */
+    uint64_t words;         /**< Number of words handled. */
+    uint64_t phrases;       /**< Number of passphrases handled. */
+    uint64_t ns;            /**< Total elapsed time. */
+    uint64_t rng_bytes;     /**< Random bytes fetched from the system. */
+};
+
+static enum format format;
+static int nresults;
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * \brief Print \p r in the selected format, along with the peak RSS so far.
+ */
+static void report(const struct result *r)
+{
+    struct rusage ru;
+    double ns_word, rate;
+
+    getrusage(RUSAGE_SELF, &ru);
+    ns_word = r->words > 0 ? (double)r->ns / r->words : 0.0;
+    rate = r->phrases > 0 && r->ns > 0 ? r->phrases * 1e9 / r->ns : 0.0;
+
+    if (format == FORMAT_JSON)
+    {
+        printf("%s\n  {\"name\": \"%s\", \"backend\": \"%s\", \"threads\": %u, "
+                "\"batch\": %zu, \"words\": %" PRIu64 ", \"phrases\": %"
+                PRIu64 ", \"ns\": %" PRIu64 ", \"ns_per_word\": %.2f, "
+                "\"phrases_per_sec\": %.1f, \"rng_bytes\": %" PRIu64 ", "
+                "\"peak_rss_kb\": %ld}", nresults > 0 ? "," : "[", r->name,
+                r->backend, r->threads, r->batch, r->words, r->phrases, r->ns,
+                ns_word, rate, r->rng_bytes, ru.ru_maxrss);
+    }
+    else
+    {
+        if (nresults == 0)
+        {
+            printf("name,backend,threads,batch,words,phrases,ns,ns_per_word,"
+                    "phrases_per_sec,rng_bytes,peak_rss_kb\n");
+        }
+        printf("%s,%s,%u,%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.2f,%.1f,%"
+                PRIu64 ",%ld\n", r->name, r->backend, r->threads, r->batch,
+                r->words, r->phrases, r->ns, ns_word, rate, r->rng_bytes,
+                ru.ru_maxrss);
+    }
+
+    nresults++;
+}
+
+/**
+ * \brief Parse a comma-separated list of positive numbers into \p list.
+ *
+ * \return Returns the number of entries, or -1 if the list is invalid.
+ */
+static int parse_list(char *arg, unsigned long *list)
+{
+    char *tok, *save, *endptr;
+    int n;
+
+    n = 0;
+    for (tok = strtok_r(arg, ",", &save); tok != NULL;
+            tok = strtok_r(NULL, ",", &save))
+    {
+        if (n == MAX_LIST)
+        {
+            return -1;
+        }
+
+        list[n] = strtoul(tok, &endptr, 10);
+        if (*endptr != '\0' || list[n] == 0)
+        {
+            return -1;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+/**
+ * \brief Time importing \p word_file into \p path, \p reps times.
+ */
+static int bench_import(const char *backend, const char *path,
+        const char *word_file, unsigned long reps)
+{
+    struct diceware dw;
+    struct result parse, insert;
+    unsigned long i;
+
+    memset(&parse, 0, sizeof(parse));
+    parse.name = "import_parse";
+    parse.backend = backend;
+    insert = parse;
+    insert.name = "import_store";
+
+    for (i = 0; i < reps; i++)
+    {
+        unlink(path);
+        if (dw_create(&dw, path, word_file) < 0)
+        {
+            return -1;
+        }
+
+        parse.ns += dw.parse_ns;
+        insert.ns += dw.insert_ns;
+        parse.words += dw.nwords;
+        insert.words += dw.nwords;
+        dw_close(&dw);
+    }
+
+    report(&parse);
+    report(&insert);
+    return 0;
+}
+
+/**
+ * \brief Time opening and closing the database at \p path, \p reps times.
+ */
+static int bench_open(const char *backend, const char *path,
+        unsigned long reps)
+{
+    struct diceware dw;
+    struct result r;
+    unsigned long i;
+    uint64_t start;
+
+    memset(&r, 0, sizeof(r));
+    r.name = "open";
+    r.backend = backend;
+
+    for (i = 0; i < reps; i++)
+    {
+        start = now();
+        if (dw_open(&dw, path) < 0)
+        {
+            return -1;
+        }
+        dw_close(&dw);
+        r.ns += now() - start;
+    }
+
+    report(&r);
+    return 0;
+}
+
+/**
+ * \brief Time drawing \p nwords random slots.
+ */
+static int bench_rng(struct diceware *dw, uint64_t nwords)
+{
+    struct result r;
+    uint32_t slots[1024];
+    uint64_t start, done, before;
+    size_t n;
+
+    memset(&r, 0, sizeof(r));
+    r.name = "rng";
+    r.backend = "-";
+    r.words = nwords;
+
+    before = dw->rng_bytes;
+    start = now();
+    for (done = 0; done < nwords; done += n)
+    {
+        n = nwords - done < 1024 ? nwords - done : 1024;
+        if (dw_sample(dw, slots, n) < 0)
+        {
+            return -1;
+        }
+    }
+    r.ns = now() - start;
+    r.rng_bytes = dw->rng_bytes - before;
+
+    report(&r);
+    return 0;
+}
+
+/**
+ * \brief Time looking up \p nwords random words.
+ */
+static int bench_lookup(struct diceware *dw, const char *backend,
+        uint64_t nwords)
+{
+    struct result r;
+    uint32_t slots[1024];
+    char buf[64];
+    uint64_t start, elapsed, done;
+    size_t i, n;
+
+    memset(&r, 0, sizeof(r));
+    r.name = "lookup";
+    r.backend = backend;
+    r.words = nwords;
+
+    /* Only the lookups are timed, not drawing the slots. */
+    elapsed = 0;
+    for (done = 0; done < nwords; done += n)
+    {
+        n = nwords - done < 1024 ? nwords - done : 1024;
+        if (dw_sample(dw, slots, n) < 0)
+        {
+            return -1;
+        }
+
+        start = now();
+        for (i = 0; i < n; i++)
+        {
+            if (dw_word(dw, slots[i], buf, sizeof(buf)) == NULL)
+            {
+                return -1;
+            }
+        }
+        elapsed += now() - start;
+    }
+    r.ns = elapsed;
+
+    report(&r);
+    return 0;
+}
+
+/**
+ * \brief Time generating \p count passphrases of \p nwords words to
+ * \c /dev/null, \p batch at a time, using \p threads threads.
+ */
+static int bench_generate(struct diceware *dw, const char *backend,
+        FILE *devnull, size_t nwords, size_t count, size_t batch,
+        unsigned threads)
+{
+    struct result r;
+    uint64_t start, before;
+    size_t done, n;
+
+    memset(&r, 0, sizeof(r));
+    r.name = "generate";
+    r.backend = backend;
+    r.threads = threads;
+    r.batch = batch;
+    r.words = (uint64_t)nwords * count;
+    r.phrases = count;
+
+    before = dw->rng_bytes;
+    start = now();
+    for (done = 0; done < count; done += n)
+    {
+        n = count - done < batch ? count - done : batch;
+        if (dw_generate_parallel(dw, devnull, nwords, n, threads) < 0)
+        {
+            return -1;
+        }
+    }
+    if (fflush(devnull) != 0)
+    {
+        warn("fflush");
+        return -1;
+    }
+    r.ns = now() - start;
+    r.rng_bytes = dw->rng_bytes - before;
+
+    report(&r);
+    return 0;
+}
+
+/**
+ * \brief Run the lookup and generation benchmarks against the open word list
+ * \p dw.
+ */
+static int bench_words(struct diceware *dw, const char *backend,
+        FILE *devnull, size_t nwords, size_t count,
+        const unsigned long *batches, int nbatches,
+        const unsigned long *threads, int nthreads)
+{
+    int i, j, rc;
+
+    rc = bench_lookup(dw, backend, (uint64_t)nwords * count);
+    for (i = 0; i < nbatches && rc == 0; i++)
+    {
+        for (j = 0; j < nthreads && rc == 0; j++)
+        {
+            rc = bench_generate(dw, backend, devnull, nwords, count,
+                    batches[i], threads[j]);
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * \brief Open \p path with \p flags and run the lookup and generation
+ * benchmarks against it.
+ */
+static int bench_backend(const char *backend, const char *path,
+        unsigned flags, FILE *devnull, size_t nwords, size_t count,
+        const unsigned long *batches, int nbatches,
+        const unsigned long *threads, int nthreads)
+{
+    struct dw_options opts;
+    struct diceware dw;
+    int rc;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.flags = flags;
+    if (dw_open_v2(&dw, path, &opts) < 0)
+    {
+        return -1;
+    }
+
+    rc = bench_words(&dw, backend, devnull, nwords, count, batches, nbatches,
+            threads, nthreads);
+
+    dw_close(&dw);
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    struct diceware dw;
+    unsigned long batches[MAX_LIST], threads[MAX_LIST];
+    unsigned long len, count, reps;
+    int nbatches, nthreads, arg, rc;
+    char *word_file, *endptr;
+    char dir[] = "/tmp/diceware_bench.XXXXXX";
+    char db_path[64], dwl_path[64];
+    FILE *devnull;
+
+    /* Set defaults */
+    len = 4;
+    count = 100000;
+    reps = 5;
+    word_file = "eff_large_wordlist.txt";
+    batches[0] = 1000;
+    nbatches = 1;
+    threads[0] = 1;
+    nthreads = 1;
+    format = FORMAT_CSV;
+
+    opterr = 0;
+    while ((arg = getopt(argc, argv, "b:c:f:hj:n:r:w:")) != -1)
+    {
+        switch (arg)
+        {
+        /* Passphrases generated per call. */
+        case 'b':
+            nbatches = parse_list(optarg, batches);
+            if (nbatches <= 0)
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        /* Total passphrases generated per benchmark. */
+        case 'c':
+            count = strtoul(optarg, &endptr, 10);
+            if (*endptr != '\0' || count == 0)
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'f':
+            if (strcmp(optarg, "csv") == 0)
+            {
+                format = FORMAT_CSV;
+            }
+            else if (strcmp(optarg, "json") == 0)
+            {
+                format = FORMAT_JSON;
+            }
+            else
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'h':
+            fprintf(stderr, USAGE_STRING, argv[0]);
+            exit(EXIT_SUCCESS);
+            break;
+        /* Thread counts to generate with. */
+        case 'j':
+            nthreads = parse_list(optarg, threads);
+            if (nthreads <= 0)
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        /* Words per passphrase. */
+        case 'n':
+            len = strtoul(optarg, &endptr, 10);
+            if (*endptr != '\0' || len == 0)
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        /* Repetitions of the import and open benchmarks. */
+        case 'r':
+            reps = strtoul(optarg, &endptr, 10);
+            if (*endptr != '\0' || reps == 0)
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'w':
+            word_file = optarg;
+            break;
+        default:
+            fprintf(stderr, USAGE_STRING, argv[0]);
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    if (mkdtemp(dir) == NULL)
+    {
+        err(EXIT_FAILURE, "mkdtemp");
+    }
+    snprintf(db_path, sizeof(db_path), "%s/bench.db", dir);
+    snprintf(dwl_path, sizeof(dwl_path), "%s/bench.dwl", dir);
+
+    devnull = fopen("/dev/null", "w");
+    if (devnull == NULL)
+    {
+        err(EXIT_FAILURE, "fopen(/dev/null)");
+    }
+
+    rc = bench_import("sqlite", db_path, word_file, reps);
+    if (rc == 0)
+    {
+        rc = bench_import("dwl", dwl_path, word_file, reps);
+    }
+    if (rc == 0)
+    {
+        rc = bench_open("sqlite", db_path, reps);
+    }
+    if (rc == 0)
+    {
+        rc = bench_open("dwl", dwl_path, reps);
+    }
+
+    if (rc == 0)
+    {
+        rc = dw_open(&dw, dwl_path);
+        if (rc == 0)
+        {
+            rc = bench_rng(&dw, (uint64_t)len * count);
+            dw_close(&dw);
+        }
+    }
+
+    if (rc == 0)
+    {
+        rc = bench_backend("sqlite", db_path, DW_OPEN_NOTABLE, devnull, len,
+                count, batches, nbatches, threads, nthreads);
+    }
+    if (rc == 0)
+    {
+        rc = bench_backend("table", db_path, 0, devnull, len, count, batches,
+                nbatches, threads, nthreads);
+    }
+    if (rc == 0)
+    {
+        rc = bench_backend("dwl", dwl_path, 0, devnull, len, count, batches,
+                nbatches, threads, nthreads);
+    }
+#ifdef DICEWARE_BUILTIN
+    if (rc == 0)
+    {
+        rc = dw_open_builtin(&dw);
+        if (rc == 0)
+        {
+            rc = bench_words(&dw, "builtin", devnull, len, count, batches,
+                    nbatches, threads, nthreads);
+            dw_close(&dw);
+        }
+    }
+#endif
+
+    if (format == FORMAT_JSON && nresults > 0)
+    {
+        printf("\n]\n");
+    }
+
+    fclose(devnull);
+    unlink(db_path);
+    unlink(dwl_path);
+    rmdir(dir);
+
+    return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,485 @@
+/**
+ * \file denylist.c
+ *
+ * \brief Screening passphrases against a corpus of breached passwords.
+ *
+ * The corpus is a file of raw 20-byte SHA-1 hashes in ascending order, with
+ * nothing else in it; hundreds of millions of hashes are expected. The file
+ * is mapped into memory, not read, and looked up by interpolation search,
+ * which takes a handful of probes since SHA-1 hashes are uniformly
+ * distributed.
+ *
+ * Each probe may be a page fault into a file much larger than the page
+ * cache, so a Bloom filter sits in front of the search. Almost every
+ * passphrase generated is not in the corpus, and the filter turns those away
+ * after a few cache misses without touching the file.
+ *
+ * Building the filter means reading the whole corpus, so it is only done the
+ * first time a corpus is used, checking on the way that the file is sorted.
+ * The filter is then saved next to the corpus as <tt>corpus.bloom</tt>, along
+ * with the size and modification time of the corpus, and later runs map it
+ * straight into memory as long as those still match.
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "denylist.h"
+
+/**
+ * Bits of Bloom filter per hash in the corpus, for a false positive rate of
+ * about 3%.
+ */
+#define BLOOM_BITS_PER_HASH 8
+
+/**
+ * Largest Bloom filter to build, in bits (128 MiB). Bigger corpora get fewer
+ * bits per hash and more false positives, which only cost a search.
+ */
+#define BLOOM_MAX_BITS ((uint64_t)1 << 30)
+
+/**
+ * Number of bits set in the Bloom filter for each hash.
+ */
+#define BLOOM_PROBES 3
+
+/**
+ * Magic bytes at the start of every saved Bloom filter.
+ */
+#define BLOOM_MAGIC "DWBLOOM"
+
+/**
+ * Version of the saved Bloom filter format.
+ */
+#define BLOOM_VERSION 1
+
+/**
+ * Value of #bloom_header.byteorder as seen by a host with the same byte order.
+ */
+#define BLOOM_BYTEORDER 0x01020304
+
+/**
+ * Header of a saved Bloom filter, followed by the filter itself.
+ */
+struct bloom_header
+{
+    char magic[8];          /**< #BLOOM_MAGIC, including the NUL. */
+    uint32_t byteorder;     /**< #BLOOM_BYTEORDER in the writer's byte order. */
+    uint32_t version;       /**< Format version, #BLOOM_VERSION. */
+    uint64_t size;          /**< Size of the corpus in bytes. */
+    int64_t mtime_sec;      /**< Modification time of the corpus. */
+    int64_t mtime_nsec;     /**< Nanoseconds of #mtime_sec. */
+    uint64_t nbits;         /**< Number of bits in the filter. */
+};
+
+/**
+ * \brief Return the first 8 bytes of \p hash as a big-endian number, which
+ * sorts like the hash itself.
+ */
+static uint64_t _denylist_key(const uint8_t *hash)
+{
+    uint64_t key;
+    int i;
+
+    key = 0;
+    for (i = 0; i < 8; i++)
+    {
+        key = key << 8 | hash[i];
+    }
+
+    return key;
+}
+
+/**
+ * \brief Return the bit for probe \p i of \p hash in the Bloom filter of
+ * \p deny.
+ *
+ * The hash is already uniformly distributed, so its bytes after the ones the
+ * file is sorted by are used as they are.
+ */
+static uint64_t _denylist_bit(const struct denylist *deny, const uint8_t *hash,
+        int i)
+{
+    uint32_t word;
+
+    memcpy(&word, hash + 8 + 4 * i, sizeof(word));
+    return word & deny->mask;
+}
+
+/**
+ * \brief Fill in the header of the Bloom filter saved for the corpus
+ * described by \p st.
+ */
+static void _denylist_header(struct bloom_header *hdr, const struct stat *st,
+        uint64_t nbits)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, BLOOM_MAGIC, sizeof(BLOOM_MAGIC));
+    hdr->byteorder = BLOOM_BYTEORDER;
+    hdr->version = BLOOM_VERSION;
+    hdr->size = st->st_size;
+    hdr->mtime_sec = st->st_mtim.tv_sec;
+    hdr->mtime_nsec = st->st_mtim.tv_nsec;
+    hdr->nbits = nbits;
+}
+
+/**
+ * \brief Map the Bloom filter saved at \p bloom_path, if it was saved for the
+ * corpus described by \p st.
+ *
+ * \return Returns 1 if the filter was mapped, or 0 if there is no usable
+ * filter.
+ */
+static int _denylist_load(struct denylist *deny, const char *bloom_path,
+        const struct stat *st)
+{
+    struct bloom_header expect;
+    const struct bloom_header *hdr;
+    struct stat bst;
+    void *base;
+    int fd;
+
+    fd = open(bloom_path, O_RDONLY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    if (fstat(fd, &bst) < 0 || (size_t)bst.st_size < sizeof(*hdr))
+    {
+        close(fd);
+        return 0;
+    }
+
+    base = mmap(NULL, bst.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    /* The filter must be for this very corpus, and a whole power of two bits
+     * long so the probes can be masked into it.
+     */
+    hdr = base;
+    _denylist_header(&expect, st, hdr->nbits);
+    if (memcmp(hdr, &expect, sizeof(expect)) != 0 || hdr->nbits < 64
+            || (hdr->nbits & (hdr->nbits - 1)) != 0
+            || (uint64_t)bst.st_size != sizeof(*hdr) + hdr->nbits / 8)
+    {
+        munmap(base, bst.st_size);
+        return 0;
+    }
+
+    deny->bloom_base = base;
+    deny->bloom_len = bst.st_size;
+    deny->bloom = (const uint64_t *)(hdr + 1);
+    deny->mask = hdr->nbits - 1;
+
+    return 1;
+}
+
+/**
+ * \brief Save the Bloom filter \p bloom of \p nbits bits for the corpus
+ * described by \p st to \p bloom_path.
+ *
+ * The filter is written to a temporary file and renamed into place, so other
+ * processes never see a partial filter.
+ */
+static int _denylist_save(const char *bloom_path, const struct stat *st,
+        const uint64_t *bloom, uint64_t nbits)
+{
+    struct bloom_header hdr;
+    char tmp[4096];
+    FILE *output;
+    int fd, rc;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", bloom_path) >= (int)sizeof(tmp))
+    {
+        warnx("path too long: %s", bloom_path);
+        return -1;
+    }
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        warn("open(%s)", tmp);
+        return -1;
+    }
+
+    output = fdopen(fd, "wb");
+    if (output == NULL)
+    {
+        warn("fdopen(%s)", tmp);
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+
+    _denylist_header(&hdr, st, nbits);
+    rc = 0;
+    if (fwrite(&hdr, sizeof(hdr), 1, output) != 1
+            || fwrite(bloom, sizeof(*bloom), nbits / 64, output) != nbits / 64)
+    {
+        warn("fwrite(%s)", tmp);
+        rc = -1;
+    }
+
+    if (rc == 0 && (fflush(output) != 0 || fsync(fd) < 0))
+    {
+        warn("fsync(%s)", tmp);
+        rc = -1;
+    }
+
+    if (fclose(output) != 0 && rc == 0)
+    {
+        warn("fclose(%s)", tmp);
+        rc = -1;
+    }
+
+    if (rc == 0 && rename(tmp, bloom_path) < 0)
+    {
+        warn("rename(%s)", bloom_path);
+        rc = -1;
+    }
+
+    if (rc < 0)
+    {
+        unlink(tmp);
+    }
+
+    return rc;
+}
+
+/**
+ * \brief Build the Bloom filter of \p deny, checking on the way that the
+ * hashes are sorted, and save it to \p bloom_path for later runs.
+ *
+ * If the filter cannot be saved, it is still used for this run.
+ */
+static int _denylist_build(struct denylist *deny, const char *path,
+        const char *bloom_path, const struct stat *st)
+{
+    const uint8_t *hash;
+    uint64_t *bloom;
+    uint64_t nbits, bit;
+    size_t i;
+    int j;
+
+    for (nbits = 64; nbits < BLOOM_MAX_BITS
+            && nbits < (uint64_t)deny->nhashes * BLOOM_BITS_PER_HASH;
+            nbits *= 2)
+    {
+    }
+
+    bloom = calloc(nbits / 64, sizeof(*bloom));
+    if (bloom == NULL)
+    {
+        warn("calloc");
+        return -1;
+    }
+    deny->bloom_buf = bloom;
+    deny->bloom = bloom;
+    deny->mask = nbits - 1;
+
+    madvise(deny->base, deny->len, MADV_SEQUENTIAL);
+    for (i = 0; i < deny->nhashes; i++)
+    {
+        hash = deny->hashes + i * SHA1_DIGEST_LENGTH;
+        if (i > 0 && memcmp(hash - SHA1_DIGEST_LENGTH, hash,
+                    SHA1_DIGEST_LENGTH) > 0)
+        {
+            warnx("%s: hashes are not sorted", path);
+            return -1;
+        }
+
+        for (j = 0; j < BLOOM_PROBES; j++)
+        {
+            bit = _denylist_bit(deny, hash, j);
+            bloom[bit / 64] |= (uint64_t)1 << (bit % 64);
+        }
+    }
+    madvise(deny->base, deny->len, MADV_RANDOM);
+
+    if (_denylist_save(bloom_path, st, bloom, nbits) < 0)
+    {
+        warnx("%s: filter not saved; it will be built again next time",
+                path);
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Map the sorted hash file at \p path into memory.
+ *
+ * The Bloom filter saved at <tt>path.bloom</tt> is used if it is up to date;
+ * otherwise it is built, which reads the whole file, and saved there.
+ *
+ * \param deny Filled in with the mapping on success.
+ * \param path Path to a file of sorted, raw SHA-1 hashes.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int denylist_open(struct denylist *deny, const char *path)
+{
+    struct stat st;
+    char bloom_path[4096];
+    int fd;
+
+    memset(deny, 0, sizeof(*deny));
+
+    if (snprintf(bloom_path, sizeof(bloom_path), "%s.bloom", path)
+            >= (int)sizeof(bloom_path))
+    {
+        warnx("path too long: %s", path);
+        return -1;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        warn("open(%s)", path);
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0)
+    {
+        warn("fstat(%s)", path);
+        close(fd);
+        return -1;
+    }
+    else if (st.st_size % SHA1_DIGEST_LENGTH != 0)
+    {
+        warnx("%s: not a file of SHA-1 hashes", path);
+        close(fd);
+        return -1;
+    }
+
+    /* An empty corpus is valid, but cannot be mapped, and needs no filter. */
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    deny->base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (deny->base == MAP_FAILED)
+    {
+        warn("mmap(%s)", path);
+        deny->base = NULL;
+        return -1;
+    }
+    deny->len = st.st_size;
+    deny->hashes = deny->base;
+    deny->nhashes = st.st_size / SHA1_DIGEST_LENGTH;
+    madvise(deny->base, deny->len, MADV_RANDOM);
+
+    if (!_denylist_load(deny, bloom_path, &st)
+            && _denylist_build(deny, path, bloom_path, &st) < 0)
+    {
+        denylist_close(deny);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Check whether \p digest is one of the hashes in \p deny.
+ *
+ * Interpolation search guesses where the hash would be from its value;
+ * alternating with bisection bounds the number of probes even if the file is
+ * not as uniform as it should be.
+ *
+ * \return Returns 1 if the hash is in the file, or 0 otherwise.
+ */
+int denylist_contains(const struct denylist *deny,
+        const uint8_t digest[SHA1_DIGEST_LENGTH])
+{
+    const uint8_t *hash;
+    uint64_t key, lokey, hikey, bit;
+    size_t lo, hi, mid;
+    int i, bisect, cmp;
+
+    if (deny->nhashes == 0)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < BLOOM_PROBES; i++)
+    {
+        bit = _denylist_bit(deny, digest, i);
+        if (!(deny->bloom[bit / 64] & ((uint64_t)1 << (bit % 64))))
+        {
+            return 0;
+        }
+    }
+
+    key = _denylist_key(digest);
+    lo = 0;
+    hi = deny->nhashes;
+    bisect = 0;
+    while (lo < hi)
+    {
+        lokey = _denylist_key(deny->hashes + lo * SHA1_DIGEST_LENGTH);
+        hikey = _denylist_key(deny->hashes + (hi - 1) * SHA1_DIGEST_LENGTH);
+        if (key < lokey || key > hikey)
+        {
+            return 0;
+        }
+
+        if (bisect || hikey == lokey)
+        {
+            mid = lo + (hi - lo) / 2;
+        }
+        else
+        {
+            mid = lo + (size_t)((unsigned __int128)(key - lokey)
+                    * (hi - 1 - lo) / (hikey - lokey));
+        }
+        bisect = !bisect;
+
+        hash = deny->hashes + mid * SHA1_DIGEST_LENGTH;
+        cmp = memcmp(digest, hash, SHA1_DIGEST_LENGTH);
+        if (cmp == 0)
+        {
+            return 1;
+        }
+        else if (cmp < 0)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Unmap the hash file of \p deny and release its Bloom filter.
+ */
+void denylist_close(struct denylist *deny)
+{
+    if (deny->base != NULL)
+    {
+        munmap(deny->base, deny->len);
+    }
+    if (deny->bloom_base != NULL)
+    {
+        munmap(deny->bloom_base, deny->bloom_len);
+    }
+    free(deny->bloom_buf);
+    memset(deny, 0, sizeof(*deny));
+}
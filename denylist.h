@@ -0,0 +1,39 @@
+/**
+ * \file denylist.h
+ */
+
+#ifndef _DENYLIST_H_
+#define _DENYLIST_H_
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sha1.h"
+
+/**
+ * Sorted file of SHA-1 hashes mapped into memory, with a Bloom filter in
+ * front of it.
+ */
+struct denylist
+{
+    void *base;             /**< Start of the mapping. */
+    size_t len;             /**< Length of the mapping. */
+    const uint8_t *hashes;  /**< Sorted hashes inside the mapping. */
+    size_t nhashes;         /**< Number of hashes. */
+    const uint64_t *bloom;  /**< Bloom filter over the hashes, or \c NULL if
+                                 there are none. */
+    uint64_t mask;          /**< Number of bits in #bloom, less one. */
+    void *bloom_base;       /**< Mapping of the saved filter, if #bloom was
+                                 loaded from one. */
+    size_t bloom_len;       /**< Length of #bloom_base. */
+    uint64_t *bloom_buf;    /**< #bloom, if it was built in memory. */
+};
+
+int denylist_open(struct denylist *deny, const char *path);
+int denylist_contains(const struct denylist *deny,
+        const uint8_t digest[SHA1_DIGEST_LENGTH]);
+void denylist_close(struct denylist *deny);
+
+
+#endif /* end of include guard: _DENYLIST_H_ */
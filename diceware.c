@@ -15,12 +15,20 @@
  * Each number should be unique and should only contain the digits 1-6. Words
  * should also be unique.
  *
+ * Instead of an SQLite database, the list may also be stored as a compact word
+ * list (see dwl.c), which is mapped straight into memory when opened.
+ * #dw_export() converts between the two. Builds with a word list compiled in
+ * can skip the database entirely with #dw_open_builtin().
+ *
  * To use this module, begin by calling either #dw_create() to construct a new
- * database or #dw_open() to open a connection to an existing database. Then,
- * call #dw_generate() to generate a passphrase and print it to the file of your
- * choice. Last, call #dw_close() to cleanup the database. Note that #dw_close()
- * must always be called to cleanup memory whenever #dw_open() or #dw_create()
- * succeed.
+ * database or #dw_open() to open a connection to an existing database. Unless
+ * the word list is very large, opening the database reads the whole list into
+ * an in-memory table indexed by dice roll, so generating a word does not touch
+ * SQLite at all. Then, call #dw_generate() to generate a passphrase and print
+ * it to the file of your choice, or #dw_generate_batch() to generate many at
+ * once. Last, call #dw_close() to cleanup the database. Note that
+ * #dw_close() must always be called to cleanup memory whenever #dw_open() or
+ * #dw_create() succeed.
  *
  * For any of these functions, if an error is encountered, a message describing
  * the issue is printed to \c stderr (along with some diagnostic information),
@@ -30,10 +38,22 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef DICEWARE_GETRANDOM
+#include <sys/random.h>
+#endif
 
 /* If we are linux, need to include BSD stdlib for arc4random functions. On
  * other unixen, these functions should already be in stdlib.h. If you are using
@@ -44,362 +64,4902 @@ typedef unsigned char u_char;
 #include <bsd/stdlib.h>
 #endif
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
 #include <sqlite3.h>
 
+#include "denylist.h"
 #include "diceware.h"
+#include "dwl.h"
+#include "sha1.h"
 
 /**
- * Number of dice used for generating indices.
+ * Maximum value a die can roll.
  */
-#define NDICE 5
+#define MAX_DIE_ROLL 6
 
 /**
- * Maximum value a die can roll.
+ * Largest number of dice in a roll; 6^8 words is already more than any list
+ * kept in memory.
  */
-#define MAX_DIE_ROLL 6
+#define DICE_MAX 8
+
+/**
+ * Number of dice and words in the classic diceware list, which is the shape of
+ * any list stored before sizes were recorded.
+ */
+#define DEFAULT_DICE 5
+#define DEFAULT_WORDS 7776
+
+/**
+ * Largest word list accepted, whether or not it is indexed by dice rolls.
+ */
+#define LIST_MAX_WORDS (1u << 24)
+
+/**
+ * Largest number of words taken from each 64-bit random draw. Lists small
+ * enough to fit more words in a draw just use some of its bits.
+ */
+#define DRAW_WORDS_MAX 8
+
+/**
+ * Table holding the default word list; named lists are kept in tables called
+ * <tt>diceware_name</tt>.
+ */
+#define DEFAULT_TABLE "diceware"
+
+/**
+ * Longest name of a named word list.
+ */
+#define LIST_NAME_MAX 64
+
+/**
+ * Longest word accepted in a word list file.
+ */
+#define WORD_MAX DW_WORD_MAX
+
+/**
+ * Size of the buffer used to batch up generated output.
+ */
+#define OUTBUF_SIZE (64 * 1024)
+
+/**
+ * Largest word list that is loaded into memory; bigger lists are queried from
+ * the database one word at a time.
+ */
+#define TABLE_MAX_WORDS (1u << 20)
+
+/**
+ * Number of 64-bit draws a #dw_rng fetches from the system at a time (4 KiB).
+ */
+#define POOL_DRAWS 512
+
+/**
+ * Number of slots drawn from a #dw_rng at a time while building a passphrase.
+ */
+#define PHRASE_SLOTS 64
+
+/**
+ * Most words #dw_words_for_bits() will put in a passphrase.
+ */
+#define BITS_MAX_WORDS 1024
+
+/**
+ * Number of passphrases handed to a worker thread at a time.
+ */
+#define CHUNK_PHRASES 1024
+
+/**
+ * Number of words resolved by one query when the word list is not in memory.
+ */
+#define LOOKUP_SLOTS 256
+
+/**
+ * Longest passphrase accepted by #dw_set_limits(), in characters.
+ */
+#define CHARS_MAX 1024
+
+/**
+ * Number of passphrases in a row found in the deny list after which
+ * generation gives up, since the list must cover nearly all of them.
+ */
+#define DENY_TRIES_MAX 1000
+
+/**
+ * Number of words on each line written by #dw_encode_bytes().
+ */
+#define CODEC_LINE_WORDS 8
+
+/**
+ * Size of the blocks read by #dw_encode_bytes().
+ */
+#define CODEC_READ_SIZE (64 * 1024)
+
+/**
+ * First delay before retrying a locked database, in nanoseconds; each retry
+ * doubles it, up to #BUSY_DELAY_MAX.
+ */
+#define BUSY_DELAY_MIN 1000000
+
+/**
+ * Longest delay between retries of a locked database, in nanoseconds.
+ */
+#define BUSY_DELAY_MAX 100000000
+
+#ifdef DICEWARE_BUILTIN
+/* Word table generated from eff_large_wordlist.txt at build time. */
+extern const uint32_t dw_builtin_nwords;
+extern const char dw_builtin_words[];
+extern const uint32_t dw_builtin_offsets[];
+extern const uint32_t dw_builtin_index[];
+#endif
+
+/**
+ * Number of passphrases that fit a character limit, for drawing passphrases
+ * uniformly from exactly those that fit.
+ */
+struct dw_chars
+{
+    size_t nrows;               /**< Most words per passphrase counted for. */
+    unsigned budget;            /**< Character limit the counts are for. */
+    unsigned __int128 *count;   /**< <tt>count[k * (budget + 1) + b]</tt> is
+                                     the number of sequences of \c k allowed
+                                     words with at most \c b letters. */
+};
+
+/**
+ * Set of the passphrases already generated, for #dw_set_unique().
+ *
+ * Each passphrase is keyed by its slots packed into as few bytes as they
+ * fit in, and stored in an open addressing table sized up front for the
+ * number of passphrases to generate, so its memory never grows.
+ */
+struct dw_seen
+{
+    size_t nwords;              /**< Words per passphrase. */
+    unsigned bits;              /**< Bits each slot is packed into. */
+    size_t keylen;              /**< Bytes per key. */
+    size_t mask;                /**< Number of buckets, less one. */
+    size_t size;                /**< Number of keys stored. */
+    size_t max;                 /**< Number of keys the set was sized for. */
+    unsigned char *keys;        /**< Key of each bucket. */
+    unsigned char *used;        /**< Bitmap of the buckets holding a key. */
+    pthread_mutex_t lock;       /**< Serializes worker threads. */
+};
+
+/**
+ * Buffer collecting generated passphrases before they are written out.
+ */
+struct dw_outbuf
+{
+    FILE *output;               /**< Stream receiving the output, or \c NULL to
+                                     keep it all in #data. */
+    int fd;                     /**< Descriptor of #output, written to directly,
+                                     or -1 to go through stdio. */
+    int fixed;                  /**< #data belongs to the caller and cannot be
+                                     grown. */
+    char *data;                 /**< Pending output. */
+    size_t len;                 /**< Number of bytes in #data. */
+    size_t cap;                 /**< Allocated size of #data. */
+    uint64_t written;           /**< Number of bytes written to #output. */
+    uint64_t ns;                /**< Time spent writing to #output. */
+};
+
+/**
+ * Writer for one of the output formats of #dw_set_format().
+ */
+struct dw_writer
+{
+    int words;                  /**< The words must be looked up; otherwise
+                                     only their slots are written. */
+    int (*word)(const struct diceware *dw, struct dw_outbuf *out,
+            const char *word, size_t len, uint32_t slot, size_t i);
+                                /**< Append word \c i of a passphrase. */
+    int (*end)(const struct diceware *dw, struct dw_outbuf *out,
+            size_t nwords);     /**< Finish a passphrase. */
+};
+
+/**
+ * Pool of random word slots, refilled from the system RNG a few kilobytes at a
+ * time so that generating a word rarely leaves the process and threads do not
+ * contend on the system RNG.
+ */
+struct dw_rng
+{
+    size_t pos;                 /**< Next unused entry in #slots. */
+    size_t nslots;              /**< Number of valid entries in #slots. */
+    unsigned fork_gen;          /**< #_dw_fork_gen as of the last refill. */
+    uint32_t nwords;            /**< Slots are drawn from [0, nwords). */
+    unsigned per_draw;          /**< Number of slots taken from each draw. */
+    unsigned shift;             /**< Bits per slot if #nwords is a power of two,
+                                     or 0. */
+    uint64_t limit;             /**< Draws at or above this are rejected. */
+    uint64_t calls;             /**< Number of refills from the system RNG. */
+    uint64_t bytes;             /**< Number of random bytes fetched. */
+    uint64_t ns;                /**< Time spent fetching random bytes. */
+    uint64_t rejects;           /**< Passphrases found in the deny list. */
+    uint32_t slots[POOL_DRAWS * DRAW_WORDS_MAX];  /**< Decoded slots. */
+};
+
+/**
+ * Bulk generation job shared between worker threads and the writer.
+ */
+struct dw_job
+{
+    struct diceware *dw;        /**< Read-only word table. */
+    size_t nwords;              /**< Words per passphrase. */
+    size_t count;               /**< Total passphrases to generate. */
+    size_t nchunks;             /**< Number of #CHUNK_PHRASES sized chunks. */
+    unsigned nthreads;          /**< Number of worker threads. */
+    int abort;                  /**< Set when the job must stop early. */
+    pthread_mutex_t lock;       /**< Protects the worker state below. */
+    pthread_cond_t cond;        /**< Signalled whenever a buffer changes. */
+};
+
+/**
+ * State of a single worker thread.
+ */
+struct dw_worker
+{
+    struct dw_job *job;         /**< Job this worker belongs to. */
+    pthread_t thread;           /**< Handle for joining the thread. */
+    unsigned id;                /**< Worker number; handles every nthreads-th
+                                     chunk starting at this one. */
+    int full;                   /**< #out holds a chunk waiting to be
+                                     written. */
+    int error;                  /**< Generation failed; stop the job. */
+    struct dw_rng rng;          /**< Private random stream. */
+    struct dw_outbuf out;       /**< Private output buffer. */
+};
 
-/* SQL for interacting with the database. */
-#define CREATE_TABLES       "CREATE TABLE diceware (id INTEGER PRIMARY KEY, " \
+/* SQL for interacting with the database. Statements that touch a word list
+ * take the name of its table as the first %w argument of sqlite3_mprintf.
+ */
+#define CREATE_TABLES       "CREATE TABLE \"%w\" (id INTEGER PRIMARY KEY, " \
                             "word TEXT);"
 #define BEGIN_TRANSACTION   "BEGIN TRANSACTION;"
 #define END_TRANSACTION     "END TRANSACTION;"
 #define UNDO_TRANSACTION    "ROLLBACK TRANSACTION;"
-#define GET_WORD            "SELECT word FROM diceware WHERE id = ?;"
-#define INSERT_WORD         "INSERT INTO diceware (id, word) VALUES (?, ?);"
+#define GET_WORD            "SELECT word FROM \"%w\" WHERE id = ?;"
+#define GET_WORDS           "SELECT id, word FROM \"%w\" WHERE id IN (%s) " \
+                            "ORDER BY id;"
+#define INSERT_WORD         "INSERT INTO \"%w\" (id, word) VALUES (?, ?);"
+#define COUNT_WORDS         "SELECT COUNT(*) FROM \"%w\";"
+#define HAS_TABLE           "SELECT COUNT(*) FROM sqlite_master " \
+                            "WHERE type = 'table' AND name = %Q;"
+#define CREATE_INFO         "CREATE TABLE IF NOT EXISTS wordlist_info " \
+                            "(name TEXT PRIMARY KEY, " \
+                            "nwords INTEGER NOT NULL, " \
+                            "ndice INTEGER NOT NULL);"
+#define SET_INFO            "INSERT OR REPLACE INTO wordlist_info " \
+                            "(name, nwords, ndice) VALUES (%Q, %u, %u);"
+#define GET_INFO            "SELECT nwords, ndice FROM wordlist_info " \
+                            "WHERE name = %Q;"
+#define GET_ALL_WORDS       "SELECT id, word FROM \"%w\" ORDER BY id;"
+#define CREATE_INDEX        "CREATE UNIQUE INDEX \"%w:word\" ON \"%w\" (word);"
+#define GET_SLOT            "SELECT id FROM \"%w\" WHERE word = ?;"
+#define GET_WORD_ORDER      "SELECT id FROM \"%w\" ORDER BY word;"
+#define COUNT_OBJECTS       "SELECT COUNT(*) FROM sqlite_master;"
+#define FAST_IMPORT         "PRAGMA synchronous = OFF; " \
+                            "PRAGMA journal_mode = MEMORY;"
+#define READ_MMAP           "PRAGMA mmap_size = 268435456;"
 
-static int _dw_get_word(struct diceware *dw, unsigned idx, char *out,
-        size_t len)
+/**
+ * \brief Return the current time of the monotonic clock, in nanoseconds.
+ */
+static uint64_t _dw_now(void)
 {
-    int rc;
-    const char *word;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * Incremented in the child after every fork, so that a child never hands out
+ * slots that were drawn before the fork and might also be used by its parent.
+ */
+static unsigned _dw_fork_gen;
+
+/**
+ * Guards registration of the fork handler.
+ */
+static pthread_once_t _dw_fork_once = PTHREAD_ONCE_INIT;
+
+static void _dw_forked(void)
+{
+    _dw_fork_gen++;
+}
+
+static void _dw_register_fork(void)
+{
+    pthread_atfork(NULL, NULL, _dw_forked);
+}
+
+/**
+ * \brief Fill \p buf with \p len bytes from the system RNG.
+ */
+static int _dw_entropy(void *buf, size_t len)
+{
+#ifdef DICEWARE_GETRANDOM
+    uint8_t *p = buf;
+    ssize_t n;
+
+    /* Large requests may be cut short by a signal; keep asking until the
+     * buffer is full.
+     */
+    while (len > 0)
+    {
+        n = getrandom(p, len, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            warn("getrandom");
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+#else
+    arc4random_buf(buf, len);
+#endif
+
+    return 0;
+}
+
+/**
+ * \brief Decode \p pool into slots for a list whose size is a power of two.
+ *
+ * Every group of \c rng->shift bits of a uniform draw is itself uniform, so
+ * the draws are simply cut into slots and nothing is rejected.
+ *
+ * \return Returns the number of slots decoded.
+ */
+static size_t _dw_decode_pow2(struct dw_rng *rng, const uint64_t *pool)
+{
+    uint64_t x, mask;
+    size_t i, j, n;
+
+    mask = rng->nwords - 1;
+    n = 0;
+    for (i = 0; i < POOL_DRAWS; i++)
+    {
+        x = pool[i];
+        for (j = 0; j < rng->per_draw; j++)
+        {
+            rng->slots[n++] = x & mask;
+            x >>= rng->shift;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * \brief Decode \p pool into slots for a list of \p nwords words.
+ *
+ * Each draw is treated as \p per_draw base-\p nwords digits, one per slot.
+ * Draws of \p limit or more are rejected, so every slot is exactly as likely
+ * as with real dice. The rejection is done without branching: the digits of
+ * every draw are written out, and the write position only advances past them
+ * if the draw was accepted, which lets the compiler vectorize the loop.
+ *
+ * This is inlined with constant arguments for the classic list, so that the
+ * divisions become multiplications.
+ *
+ * \return Returns the number of slots decoded.
+ */
+static inline size_t _dw_decode(struct dw_rng *rng, const uint64_t *pool,
+        uint32_t nwords, unsigned per_draw, uint64_t limit)
+{
+    uint64_t x;
+    size_t i, j, n;
+
+    n = 0;
+    for (i = 0; i < POOL_DRAWS; i++)
+    {
+        x = pool[i];
+        for (j = 0; j < per_draw; j++)
+        {
+            rng->slots[n + j] = x % nwords;
+            x /= nwords;
+        }
+        n += per_draw * (pool[i] < limit);
+    }
+
+    return n;
+}
+
+/**
+ * \brief Refill the slot pool of \p rng.
+ *
+ * Fetches #POOL_DRAWS 64-bit draws at once and decodes several slots from
+ * each, rather than rolling dice separately for every word.
+ */
+static int _dw_rng_refill(struct dw_rng *rng)
+{
+    uint64_t pool[POOL_DRAWS];
+    uint64_t start;
+    size_t n;
+
+    start = _dw_now();
+    if (_dw_entropy(pool, sizeof(pool)) < 0)
+    {
+        return -1;
+    }
+    rng->ns += _dw_now() - start;
+    rng->calls++;
+    rng->bytes += sizeof(pool);
+
+    if (rng->shift != 0)
+    {
+        n = _dw_decode_pow2(rng, pool);
+    }
+    else if (rng->nwords == DEFAULT_WORDS)
+    {
+        n = _dw_decode(rng, pool, DEFAULT_WORDS, 4,
+                UINT64_MAX - UINT64_MAX % ((uint64_t)DEFAULT_WORDS
+                    * DEFAULT_WORDS * DEFAULT_WORDS * DEFAULT_WORDS));
+    }
+    else
+    {
+        n = _dw_decode(rng, pool, rng->nwords, rng->per_draw, rng->limit);
+    }
+
+    explicit_bzero(pool, sizeof(pool));
+    rng->pos = 0;
+    rng->nslots = n;
+    rng->fork_gen = _dw_fork_gen;
+
+    return 0;
+}
+
+/**
+ * \brief Fill \p slots with \p n uniformly distributed slots in
+ * [0, \c rng->nwords).
+ */
+static int _dw_rng_slots(struct dw_rng *rng, uint32_t *slots, size_t n)
+{
+    size_t i;
+
+    /* Slots drawn before a fork are shared with the other process. */
+    if (rng->fork_gen != _dw_fork_gen)
+    {
+        rng->pos = rng->nslots;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (rng->pos == rng->nslots && _dw_rng_refill(rng) < 0)
+        {
+            return -1;
+        }
+        slots[i] = rng->slots[rng->pos++];
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Set up \p rng to draw slots for a list of \p nwords words, so that
+ * the first draw fetches fresh random bytes.
+ *
+ * Works out how many slots fit in each 64-bit draw. For lists whose size is a
+ * power of two, that is the number of whole slots in 64 bits; otherwise it is
+ * the largest number of base-\p nwords digits that fit, and draws past the
+ * last whole multiple of their span are rejected.
+ */
+static void _dw_rng_init(struct dw_rng *rng, uint32_t nwords)
+{
+    uint64_t span;
+
+    pthread_once(&_dw_fork_once, _dw_register_fork);
+
+    rng->nwords = nwords;
+    rng->per_draw = 0;
+    rng->shift = 0;
+    rng->limit = 0;
+    if (nwords >= 2 && (nwords & (nwords - 1)) == 0)
+    {
+        while ((1u << rng->shift) < nwords)
+        {
+            rng->shift++;
+        }
+        rng->per_draw = 64 / rng->shift;
+    }
+    else if (nwords >= 2)
+    {
+        span = 1;
+        while (rng->per_draw < DRAW_WORDS_MAX && span <= UINT64_MAX / nwords)
+        {
+            span *= nwords;
+            rng->per_draw++;
+        }
+        rng->limit = UINT64_MAX - UINT64_MAX % span;
+    }
+    if (rng->per_draw > DRAW_WORDS_MAX)
+    {
+        rng->per_draw = DRAW_WORDS_MAX;
+    }
+
+    rng->pos = 0;
+    rng->nslots = 0;
+    rng->fork_gen = _dw_fork_gen;
+    rng->calls = 0;
+    rng->bytes = 0;
+    rng->ns = 0;
+    rng->rejects = 0;
+}
+
+/**
+ * \brief Move the usage counters of \p rng into \p dw.
+ */
+static void _dw_rng_account(struct diceware *dw, struct dw_rng *rng)
+{
+    dw->rng_calls += rng->calls;
+    dw->rng_bytes += rng->bytes;
+    dw->rng_ns += rng->ns;
+    dw->rejections += rng->rejects;
+    rng->calls = 0;
+    rng->bytes = 0;
+    rng->ns = 0;
+    rng->rejects = 0;
+}
+
+/**
+ * \brief Add the usage counters of \p rng to \p dw and erase any unused random
+ * slots it holds.
+ */
+static void _dw_rng_wipe(struct diceware *dw, struct dw_rng *rng)
+{
+    _dw_rng_account(dw, rng);
+    explicit_bzero(rng, sizeof(*rng));
+}
+
+/**
+ * \brief Convert the database id of a word into its slot in the word table.
+ *
+ * For lists indexed by dice rolls, the id \p id stores one die per decimal
+ * digit (e.g. 11111); the slot is the same roll read as a base-6 number, so
+ * slots run from 0 to <tt>6^ndice - 1</tt> in the same order as the rolls.
+ * Other lists store the slot itself.
+ *
+ * \return Returns the slot, or -1 if \p id is not a valid id.
+ */
+static int32_t _dw_slot(const struct diceware *dw, sqlite3_int64 id)
+{
+    int32_t slot, scale;
+    int digit;
+    size_t i;
+
+    if (dw->ndice == 0)
+    {
+        return id >= 0 && id < dw->nwords ? (int32_t)id : -1;
+    }
+
+    slot = 0;
+    scale = 1;
+    for (i = 0; i < dw->ndice; i++)
+    {
+        digit = id % 10;
+        if (digit < 1 || digit > MAX_DIE_ROLL)
+        {
+            return -1;
+        }
+
+        slot += (digit - 1) * scale;
+        scale *= MAX_DIE_ROLL;
+        id /= 10;
+    }
+
+    return id == 0 ? slot : -1;
+}
+
+/**
+ * \brief Convert a slot in the word table back into its database id.
+ *
+ * This is the inverse of #_dw_slot(), used to look words up in the database.
+ */
+static uint32_t _dw_roll(const struct diceware *dw, uint32_t slot)
+{
+    uint32_t id, scale;
+    size_t i;
+
+    if (dw->ndice == 0)
+    {
+        return slot;
+    }
+
+    id = 0;
+    scale = 1;
+    for (i = 0; i < dw->ndice; i++)
+    {
+        id += (slot % MAX_DIE_ROLL + 1) * scale;
+        scale *= 10;
+        slot /= MAX_DIE_ROLL;
+    }
+
+    return id;
+}
+
+/**
+ * \brief Busy handler for SQLite connections, called whenever the database is
+ * locked by another connection.
+ *
+ * Sleeps for an exponentially growing delay before each retry, and gives up
+ * once \c dw->busy_timeout milliseconds have passed since the first attempt.
+ * The retries and the time spent waiting are recorded in \p arg.
+ *
+ * \param arg Handle owning the connection.
+ * \param count Number of times the handler has already been called for this
+ * lock.
+ *
+ * \return Returns nonzero to retry, or 0 to fail with \c SQLITE_BUSY.
+ */
+static int _dw_busy(void *arg, int count)
+{
+    struct diceware *dw = arg;
+    struct timespec ts;
+    uint64_t now, deadline, delay;
+    int i;
+
+    now = _dw_now();
+    if (count == 0)
+    {
+        dw->busy_start = now;
+    }
+
+    deadline = dw->busy_start + dw->busy_timeout * 1000000ull;
+    if (now >= deadline)
+    {
+        return 0;
+    }
+
+    delay = BUSY_DELAY_MIN;
+    for (i = 0; i < count && delay < BUSY_DELAY_MAX; i++)
+    {
+        delay *= 2;
+    }
+    if (delay > BUSY_DELAY_MAX)
+    {
+        delay = BUSY_DELAY_MAX;
+    }
+    if (delay > deadline - now)
+    {
+        delay = deadline - now;
+    }
+
+    ts.tv_sec = delay / 1000000000u;
+    ts.tv_nsec = delay % 1000000000u;
+    nanosleep(&ts, NULL);
+
+    dw->sql_busy++;
+    dw->busy_ns += _dw_now() - now;
+    return 1;
+}
+
+/**
+ * \brief Prepare the statement built from \p fmt for the word list of \p dw.
+ *
+ * \p fmt is formatted with \c sqlite3_mprintf, with the name of the table
+ * holding the word list as its first argument, followed by any further
+ * arguments.
+ */
+static int _dw_prepare(struct diceware *dw, sqlite3_stmt **stmt,
+        const char *fmt, ...)
+{
+    va_list ap;
+    char *sql;
+    int rc;
+
+    va_start(ap, fmt);
+    sql = sqlite3_vmprintf(fmt, ap);
+    va_end(ap);
+    if (sql == NULL)
+    {
+        warnx("sqlite3_vmprintf: out of memory");
+        return -1;
+    }
+
+    rc = sqlite3_prepare_v2(dw->db, sql, -1, stmt, NULL);
+    if (rc != SQLITE_OK)
+    {
+        warnx("sqlite3_prepare_v2(%s): %s", sql, sqlite3_errmsg(dw->db));
+        sqlite3_free(sql);
+        return -1;
+    }
+
+    sqlite3_free(sql);
+    return 0;
+}
+
+/**
+ * \brief Step \p stmt, counting the step in \p dw and adding the time spent to
+ * \c dw->sql_ns.
+ *
+ * Waiting for a locked database is left to #_dw_busy().
+ *
+ * \return Returns the result of \c sqlite3_step.
+ */
+static int _dw_step(struct diceware *dw, sqlite3_stmt *stmt)
+{
+    uint64_t start;
+    int rc;
+
+    start = _dw_now();
+    rc = sqlite3_step(stmt);
+    dw->sql_steps++;
+    dw->sql_ns += _dw_now() - start;
+
+    return rc;
+}
+
+/**
+ * \brief Run the single-row query \p fmt about the table \p name and store
+ * the integer columns of its result in \p values.
+ *
+ * \return Returns 1 if the query returned a row, 0 if it returned none, or -1
+ * on error.
+ */
+static int _dw_query_ints(struct diceware *dw, sqlite3_int64 *values,
+        int nvalues, const char *fmt, const char *name)
+{
+    sqlite3_stmt *stmt;
+    int i, rc;
+
+    if (_dw_prepare(dw, &stmt, fmt, name) < 0)
+    {
+        return -1;
+    }
+
+    rc = _dw_step(dw, stmt);
+    if (rc == SQLITE_ROW)
+    {
+        for (i = 0; i < nvalues; i++)
+        {
+            values[i] = sqlite3_column_int64(stmt, i);
+        }
+        rc = 1;
+    }
+    else if (rc == SQLITE_DONE)
+    {
+        rc = 0;
+    }
+    else
+    {
+        warnx("sqlite3_step(%s): %s", sqlite3_sql(stmt),
+                sqlite3_errmsg(dw->db));
+        rc = -1;
+    }
+
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
+/**
+ * \brief Work out the size of the word list in the database of \p dw.
+ *
+ * The size and number of dice of each list are recorded in \c wordlist_info
+ * when it is stored. Databases from before that table existed only ever held
+ * the classic list of #DEFAULT_WORDS words indexed by #DEFAULT_DICE dice.
+ * Either way, the table must hold exactly that many words.
+ */
+static int _dw_shape(struct diceware *dw)
+{
+    sqlite3_int64 values[2];
+    int rc;
+
+    rc = _dw_query_ints(dw, values, 1, HAS_TABLE, "wordlist_info");
+    if (rc == 1 && values[0] > 0)
+    {
+        rc = _dw_query_ints(dw, values, 2, GET_INFO, dw->table);
+    }
+    else if (rc == 1)
+    {
+        rc = 0;
+    }
+    if (rc < 0)
+    {
+        return -1;
+    }
+    else if (rc == 0)
+    {
+        values[0] = DEFAULT_WORDS;
+        values[1] = DEFAULT_DICE;
+    }
+
+    if (values[0] < 2 || values[0] > LIST_MAX_WORDS || values[1] < 0
+            || values[1] > DICE_MAX)
+    {
+        warnx("invalid word list size");
+        return -1;
+    }
+    dw->nwords = values[0];
+    dw->ndice = values[1];
+
+    rc = _dw_query_ints(dw, values, 1, COUNT_WORDS, dw->table);
+    if (rc < 0)
+    {
+        return -1;
+    }
+    else if (rc == 0 || values[0] != dw->nwords)
+    {
+        warnx("incomplete database");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Word and slot pair, sorted to build a reverse index in memory.
+ */
+struct dw_index_entry
+{
+    const char *word;
+    uint32_t slot;
+};
+
+static int _dw_cmp_index_entry(const void *a, const void *b)
+{
+    return strcmp(((const struct dw_index_entry *)a)->word,
+            ((const struct dw_index_entry *)b)->word);
+}
+
+/**
+ * \brief Build the reverse index of the in-memory word table of \p dw by
+ * sorting its words.
+ *
+ * This is only needed for word lists being imported; stored lists keep their
+ * index.
+ */
+static int _dw_index(struct diceware *dw)
+{
+    struct dw_index_entry *entries;
+    uint32_t i;
+
+    entries = malloc((size_t)dw->nwords * sizeof(*entries));
+    dw->index_buf = malloc((size_t)dw->nwords * sizeof(*dw->index_buf));
+    if (entries == NULL || dw->index_buf == NULL)
+    {
+        warn("malloc");
+        free(entries);
+        return -1;
+    }
+
+    for (i = 0; i < dw->nwords; i++)
+    {
+        entries[i].word = dw->words + dw->offsets[i];
+        entries[i].slot = i;
+    }
+    qsort(entries, dw->nwords, sizeof(*entries), _dw_cmp_index_entry);
+
+    for (i = 0; i < dw->nwords; i++)
+    {
+        dw->index_buf[i] = entries[i].slot;
+    }
+    dw->index = dw->index_buf;
+
+    free(entries);
+    return 0;
+}
+
+/**
+ * \brief Read the reverse index of the word list of \p dw from the database.
+ *
+ * The rows are read in word order through the unique index on the words, so
+ * nothing needs sorting. Databases from before that index existed are still
+ * read correctly, with SQLite sorting the rows instead.
+ */
+static int _dw_load_index(struct diceware *dw)
+{
+    sqlite3_stmt *stmt;
+    int32_t slot;
+    uint32_t i;
+    int rc;
+
+    dw->index_buf = malloc((size_t)dw->nwords * sizeof(*dw->index_buf));
+    if (dw->index_buf == NULL)
+    {
+        warn("malloc");
+        return -1;
+    }
+
+    if (_dw_prepare(dw, &stmt, GET_WORD_ORDER, dw->table) < 0)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < dw->nwords; i++)
+    {
+        rc = _dw_step(dw, stmt);
+        if (rc != SQLITE_ROW)
+        {
+            warnx("sqlite3_step(%s): %s", sqlite3_sql(stmt),
+                    sqlite3_errmsg(dw->db));
+            sqlite3_finalize(stmt);
+            return -1;
+        }
+
+        slot = _dw_slot(dw, sqlite3_column_int64(stmt, 0));
+        if (slot < 0)
+        {
+            warnx("incomplete database");
+            sqlite3_finalize(stmt);
+            return -1;
+        }
+        dw->index_buf[i] = slot;
+    }
+
+    sqlite3_finalize(stmt);
+    dw->index = dw->index_buf;
+    return 0;
+}
+
+/**
+ * \brief Read the whole word list into memory.
+ *
+ * Lists with more than #TABLE_MAX_WORDS entries are left in the database, in
+ * which case \c dw->words stays \c NULL and words are looked up with
+ * #_dw_get_word() instead.
+ */
+static int _dw_load(struct diceware *dw)
+{
+    sqlite3_stmt *stmt;
+    const char *word;
+    char *words, *tmp;
+    uint32_t *offsets;
+    size_t used, cap, len;
+    uint32_t i;
+    int rc;
+
+    if (dw->nwords > TABLE_MAX_WORDS)
+    {
+        return 0;
+    }
+
+    if (_dw_prepare(dw, &stmt, GET_ALL_WORDS, dw->table) < 0)
+    {
+        return -1;
+    }
+
+    /* Words are packed back-to-back with their NUL terminators; the offsets
+     * array has one extra entry so the length of every word is known.
+     */
+    cap = (size_t)dw->nwords * 8;
+    used = 0;
+    words = malloc(cap);
+    offsets = malloc(((size_t)dw->nwords + 1) * sizeof(*offsets));
+    if (words == NULL || offsets == NULL)
+    {
+        warn("malloc");
+        goto load_error;
+    }
+
+    for (i = 0; i < dw->nwords; i++)
+    {
+        rc = _dw_step(dw, stmt);
+
+        if (rc != SQLITE_ROW)
+        {
+            warnx("sqlite3_step(%s): %s", sqlite3_sql(stmt),
+                    sqlite3_errmsg(dw->db));
+            goto load_error;
+        }
+
+        /* Rows come back sorted by id, so every slot must appear in turn. */
+        if (_dw_slot(dw, sqlite3_column_int64(stmt, 0)) != (int32_t)i)
+        {
+            warnx("incomplete database");
+            goto load_error;
+        }
+
+        word = (const char *)sqlite3_column_text(stmt, 1);
+        if (word == NULL)
+        {
+            warnx("sqlite3_column_text(%s): %s", sqlite3_sql(stmt),
+                    sqlite3_errmsg(dw->db));
+            goto load_error;
+        }
+
+        len = strlen(word) + 1;
+        if (used + len > cap)
+        {
+            cap = 2 * (used + len);
+            tmp = realloc(words, cap);
+            if (tmp == NULL)
+            {
+                warn("realloc");
+                goto load_error;
+            }
+            words = tmp;
+        }
+
+        offsets[i] = used;
+        memcpy(words + used, word, len);
+        used += len;
+    }
+    offsets[dw->nwords] = used;
+
+    sqlite3_finalize(stmt);
+
+    dw->words = words;
+    dw->offsets = offsets;
+
+    return _dw_load_index(dw);
+
+load_error:
+    free(words);
+    free(offsets);
+    sqlite3_finalize(stmt);
+    return -1;
+}
+
+static int _dw_get_word(struct diceware *dw, unsigned idx, char *out,
+        size_t len)
+{
+    int rc;
+    const char *word;
+
+    if (dw->query == NULL)
+    {
+        if (_dw_prepare(dw, &dw->query, GET_WORD, dw->table) < 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        sqlite3_reset(dw->query);
+    }
+
+    rc = sqlite3_bind_int(dw->query, 1, idx);
+    if (rc != SQLITE_OK)
+    {
+        warnx("sqlite3_bind_int: %s", sqlite3_errstr(rc));
+        return -1;
+    }
+
+    rc = _dw_step(dw, dw->query);
+
+    if (rc != SQLITE_ROW)
+    {
+        if (rc == SQLITE_DONE)
+        {
+            warnx("incomplete database");
+        }
+        else
+        {
+            warnx("sqlite3_step(%s): %s", sqlite3_sql(dw->query),
+                    sqlite3_errmsg(dw->db));
+        }
+        return -1;
+    }
+
+    word = (const char *)sqlite3_column_text(dw->query, 0);
+    if (word == NULL)
+    {
+        warnx("sqlite3_column_text(%s): %s", sqlite3_sql(dw->query),
+                sqlite3_errmsg(dw->db));
+        return -1;
+    }
+
+    strncpy(out, word, len);
+
+    return 0;
+}
+
+/**
+ * \brief Compare two 64-bit integers for \c qsort.
+ */
+static int _dw_cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * \brief Prepare the statement that looks up #LOOKUP_SLOTS words at once.
+ */
+static int _dw_prepare_lookup(struct diceware *dw)
+{
+    char params[2 * LOOKUP_SLOTS];
+    size_t i;
+
+    for (i = 0; i < LOOKUP_SLOTS; i++)
+    {
+        params[2 * i] = '?';
+        params[2 * i + 1] = ',';
+    }
+    params[sizeof(params) - 1] = '\0';
+
+    return _dw_prepare(dw, &dw->lookup, GET_WORDS, dw->table, params);
+}
+
+/**
+ * \brief Look up the words in \p n slots from the database with one query.
+ *
+ * The query asks for every slot at once and returns the distinct words sorted
+ * by roll; the slots are sorted the same way, along with their positions, so
+ * each row can be copied to every position that asked for it.
+ *
+ * \param dw Diceware database to use for words.
+ * \param slots Slots of the words to look up.
+ * \param n Number of slots, at most #LOOKUP_SLOTS.
+ * \param words Filled in with the NUL-terminated word for each slot.
+ */
+static int _dw_get_words(struct diceware *dw, const uint32_t *slots, size_t n,
+        char (*words)[WORD_MAX + 1])
+{
+    uint64_t order[LOOKUP_SLOTS];
+    const char *word;
+    int64_t slot;
+    size_t i, k;
+    int rc;
+
+    if (dw->lookup == NULL)
+    {
+        if (_dw_prepare_lookup(dw) < 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        sqlite3_reset(dw->lookup);
+    }
+
+    /* Parameters beyond n repeat the first slot, which is asked for anyway. */
+    for (i = 0; i < LOOKUP_SLOTS; i++)
+    {
+        rc = sqlite3_bind_int(dw->lookup, i + 1,
+                _dw_roll(dw, slots[i < n ? i : 0]));
+        if (rc != SQLITE_OK)
+        {
+            warnx("sqlite3_bind_int: %s", sqlite3_errstr(rc));
+            return -1;
+        }
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        order[i] = (uint64_t)slots[i] << 32 | i;
+    }
+    qsort(order, n, sizeof(*order), _dw_cmp_u64);
+
+    for (k = 0; k < n; )
+    {
+        rc = _dw_step(dw, dw->lookup);
+        if (rc != SQLITE_ROW)
+        {
+            if (rc == SQLITE_DONE)
+            {
+                warnx("incomplete database");
+            }
+            else
+            {
+                warnx("sqlite3_step(%s): %s", sqlite3_sql(dw->lookup),
+                        sqlite3_errmsg(dw->db));
+            }
+            return -1;
+        }
+
+        /* Every row must be the next slot asked for; anything else means a
+         * slot is missing from the database.
+         */
+        slot = _dw_slot(dw, sqlite3_column_int64(dw->lookup, 0));
+        if (slot != (int64_t)(order[k] >> 32))
+        {
+            warnx("incomplete database");
+            return -1;
+        }
+
+        word = (const char *)sqlite3_column_text(dw->lookup, 1);
+        if (word == NULL)
+        {
+            warnx("sqlite3_column_text(%s): %s", sqlite3_sql(dw->lookup),
+                    sqlite3_errmsg(dw->db));
+            return -1;
+        }
+
+        for (; k < n && (int64_t)(order[k] >> 32) == slot; k++)
+        {
+            i = (uint32_t)order[k];
+            strncpy(words[i], word, WORD_MAX);
+            words[i][WORD_MAX] = '\0';
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Look up the word in \p slot, from memory if the table is loaded and
+ * from the database otherwise.
+ *
+ * \param dw Diceware database to use for words.
+ * \param slot Slot of the word to look up.
+ * \param buf Buffer for the word if it has to be copied out of the database.
+ * \param size Size of \p buf.
+ * \param len Set to the length of the word.
+ *
+ * \return Returns a pointer to the word, which is only valid until the next
+ * lookup if it was copied into \p buf, or \c NULL on failure.
+ */
+static const char *_dw_word(struct diceware *dw, uint32_t slot, char *buf,
+        size_t size, size_t *len)
+{
+    if (dw->words != NULL)
+    {
+        *len = dw->offsets[slot + 1] - dw->offsets[slot] - 1;
+        return dw->words + dw->offsets[slot];
+    }
+
+    if (_dw_get_word(dw, _dw_roll(dw, slot), buf, size) != 0)
+    {
+        return NULL;
+    }
+
+    *len = strnlen(buf, size);
+    return buf;
+}
+
+static int _dw_insert(struct diceware *dw, int index, const char *word,
+        int len)
+{
+    int rc;
+
+    if (dw->insert == NULL)
+    {
+        if (_dw_prepare(dw, &dw->insert, INSERT_WORD, dw->table) < 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        sqlite3_reset(dw->insert);
+    }
+
+    rc = sqlite3_bind_int(dw->insert, 1, index);
+    if (rc != SQLITE_OK)
+    {
+        warnx("sqlite3_bind_int: %s", sqlite3_errstr(rc));
+        return -1;
+    }
+
+    rc = sqlite3_bind_text(dw->insert, 2, word, len, SQLITE_STATIC);
+    if (rc != SQLITE_OK)
+    {
+        warnx("sqlite3_bind_text: %s", sqlite3_errstr(rc));
+        return -1;
+    }
+
+    rc = _dw_step(dw, dw->insert);
+
+    if (rc != SQLITE_DONE)
+    {
+        warnx("sqlite3_step(%s): %s", sqlite3_sql(dw->insert),
+                sqlite3_errmsg(dw->db));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Check whether \p c separates fields on a line of a word list.
+ */
+static int _dw_isblank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * \brief Parse the word list at \p path into the in-memory table of \p dw.
+ *
+ * The file is mapped into memory and tokenized in a single pass. Its first row
+ * decides the kind of list:
+ *
+ * - A dice roll followed by a word starts a list indexed by dice rolls. Every
+ *   roll must have as many digits from 1 to 6 as the first one (up to
+ *   #DICE_MAX), rows may appear in any order, and every roll must appear
+ *   exactly once, so the list has <tt>6^ndice</tt> words.
+ * - A lone word starts a plain list such as BIP39, where every row is a single
+ *   word and a word's index is its position in the file.
+ *
+ * Each word must be made of printable, non-blank bytes. Once all rows are
+ * found, the words are packed into slot order.
+ */
+static int _dw_parse(struct diceware *dw, const char *path)
+{
+    struct stat st;
+    struct
+    {
+        uint32_t off;       /* Offset of the word in the file. */
+        uint32_t len;       /* Length of the word, or 0 if not seen yet. */
+    } *rows, *tmp;
+    const char *base, *p, *end, *field, *word;
+    char *words;
+    uint32_t *offsets;
+    uint32_t slot, count, size, cap, line, i;
+    size_t len, flen, used;
+    int fd, ndice;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        warn("open(%s)", path);
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0)
+    {
+        warn("fstat(%s)", path);
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size == 0)
+    {
+        warnx("too few diceware entries: %s", path);
+        close(fd);
+        return -1;
+    }
+    else if (st.st_size > UINT32_MAX)
+    {
+        warnx("invalid diceware file: %s", path);
+        close(fd);
+        return -1;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        warn("mmap(%s)", path);
+        return -1;
+    }
+
+    /* The kind and size of the list are not known until the first row. */
+    rows = NULL;
+    ndice = -1;
+    size = 0;
+    cap = 0;
+
+    p = base;
+    end = base + st.st_size;
+    count = 0;
+    used = 0;
+    line = 1;
+    while (p < end)
+    {
+        /* Skip blank space between rows, counting lines for messages. */
+        if (*p == '\n')
+        {
+            line++;
+            p++;
+            continue;
+        }
+        else if (_dw_isblank(*p))
+        {
+            p++;
+            continue;
+        }
+
+        /* A row is one or two fields, each running up to the next blank or
+         * control character.
+         */
+        field = p;
+        while (p < end && (unsigned char)*p > ' ' && *p != 0x7f)
+        {
+            p++;
+        }
+        flen = p - field;
+
+        while (p < end && _dw_isblank(*p))
+        {
+            p++;
+        }
+
+        word = p;
+        while (p < end && (unsigned char)*p > ' ' && *p != 0x7f)
+        {
+            p++;
+        }
+        len = p - word;
+
+        while (p < end && _dw_isblank(*p))
+        {
+            p++;
+        }
+
+        if (ndice < 0)
+        {
+            ndice = len != 0 ? (int)flen : 0;
+            if (ndice > DICE_MAX)
+            {
+                warnx("%s:%u: invalid dice roll", path, line);
+                goto parse_error;
+            }
+
+            size = 1;
+            for (i = 0; i < (uint32_t)ndice; i++)
+            {
+                size *= MAX_DIE_ROLL;
+            }
+            cap = ndice > 0 ? size : 1024;
+            rows = calloc(cap, sizeof(*rows));
+            if (rows == NULL)
+            {
+                warn("calloc");
+                goto parse_error;
+            }
+        }
+
+        if (ndice > 0)
+        {
+            /* Read the dice roll as a base-6 number, which is its slot. */
+            slot = 0;
+            for (i = 0; i < flen && field[i] >= '1'
+                    && field[i] <= '0' + MAX_DIE_ROLL; i++)
+            {
+                slot = MAX_DIE_ROLL * slot + (field[i] - '1');
+            }
+
+            if (flen != (size_t)ndice || i != flen || len == 0)
+            {
+                warnx("%s:%u: invalid dice roll", path, line);
+                goto parse_error;
+            }
+        }
+        else
+        {
+            /* Plain lists are indexed by position, so there is one field. */
+            if (len != 0)
+            {
+                warnx("%s:%u: invalid word", path, line);
+                goto parse_error;
+            }
+            word = field;
+            len = flen;
+            slot = count;
+
+            if (count == LIST_MAX_WORDS)
+            {
+                warnx("too many words: %s", path);
+                goto parse_error;
+            }
+            if (count == cap)
+            {
+                tmp = realloc(rows, 2 * (size_t)cap * sizeof(*rows));
+                if (tmp == NULL)
+                {
+                    warn("realloc");
+                    goto parse_error;
+                }
+                rows = tmp;
+                cap *= 2;
+            }
+            rows[slot].len = 0;
+        }
+
+        if (len == 0 || len > WORD_MAX || (p < end && *p != '\n'))
+        {
+            warnx("%s:%u: invalid word", path, line);
+            goto parse_error;
+        }
+
+        if (rows[slot].len != 0)
+        {
+            warnx("%s:%u: duplicate dice roll", path, line);
+            goto parse_error;
+        }
+
+        rows[slot].off = word - base;
+        rows[slot].len = len;
+        used += len + 1;
+        count++;
+    }
+
+    if (ndice == 0)
+    {
+        size = count;
+    }
+    if (count < 2 || count < size)
+    {
+        warnx("too few diceware entries: %s", path);
+        goto parse_error;
+    }
+
+    /* Pack the words in slot order. */
+    words = malloc(used);
+    offsets = malloc(((size_t)size + 1) * sizeof(*offsets));
+    if (words == NULL || offsets == NULL)
+    {
+        warn("malloc");
+        free(words);
+        free(offsets);
+        goto parse_error;
+    }
+
+    used = 0;
+    for (i = 0; i < size; i++)
+    {
+        offsets[i] = used;
+        memcpy(words + used, base + rows[i].off, rows[i].len);
+        used += rows[i].len;
+        words[used++] = '\0';
+    }
+    offsets[size] = used;
+
+    free(rows);
+    munmap((void *)base, st.st_size);
+
+    dw->words = words;
+    dw->offsets = offsets;
+    dw->nwords = size;
+    dw->ndice = ndice;
+
+    /* Words must be unique to map them back to their slots. */
+    if (_dw_index(dw) < 0)
+    {
+        return -1;
+    }
+    for (i = 1; i < size; i++)
+    {
+        word = words + offsets[dw->index[i]];
+        if (strcmp(words + offsets[dw->index[i - 1]], word) == 0)
+        {
+            warnx("%s: duplicate word: %s", path, word);
+            return -1;
+        }
+    }
+
+    return 0;
+
+parse_error:
+    free(rows);
+    munmap((void *)base, st.st_size);
+    return -1;
+}
+
+/**
+ * \brief Set up an empty handle, with no database or word table.
+ */
+static int _dw_init(struct diceware *dw)
+{
+    dw->rng = malloc(sizeof(*dw->rng));
+    if (dw->rng == NULL)
+    {
+        warn("malloc");
+        return -1;
+    }
+    _dw_rng_init(dw->rng, 0);
+
+    dw->table = sqlite3_mprintf("%s", DEFAULT_TABLE);
+    if (dw->table == NULL)
+    {
+        warnx("sqlite3_mprintf: out of memory");
+        free(dw->rng);
+        return -1;
+    }
+
+    dw->db = NULL;
+    dw->insert = NULL;
+    dw->query = NULL;
+    dw->lookup = NULL;
+    dw->reverse = NULL;
+    dw->words = NULL;
+    dw->offsets = NULL;
+    dw->index = NULL;
+    dw->index_buf = NULL;
+    dw->by_len = NULL;
+    dw->len_start = NULL;
+    dw->subset = NULL;
+    dw->nsubset = 0;
+    dw->min_len = 0;
+    dw->max_len = 0;
+    dw->max_chars = 0;
+    dw->chars = NULL;
+    dw->entropy = -1;
+    dw->entropy_nwords = 0;
+    dw->seen = NULL;
+    dw->collisions = 0;
+    dw->deny = NULL;
+    dw->rejections = 0;
+    dw->format = DW_FORMAT_TEXT;
+    dw->jsonl_end[0] = '\0';
+    dw->nwords = 0;
+    dw->ndice = 0;
+    dw->map = NULL;
+    dw->maplen = 0;
+    dw->builtin = 0;
+    dw->parse_ns = 0;
+    dw->insert_ns = 0;
+    dw->rng_calls = 0;
+    dw->rng_bytes = 0;
+    dw->lookups = 0;
+    dw->sql_steps = 0;
+    dw->sql_busy = 0;
+    dw->busy_timeout = DW_BUSY_TIMEOUT;
+    dw->busy_start = 0;
+    dw->busy_ns = 0;
+    dw->bytes_written = 0;
+    dw->open_ns = 0;
+    dw->rng_ns = 0;
+    dw->sql_ns = 0;
+    dw->write_ns = 0;
+    dw->generate_ns = 0;
+
+    return 0;
+}
+
+static int _dw_connect(struct diceware *dw, const char *path)
+{
+    int rc;
+    sqlite3 *db;
+
+    rc = sqlite3_open(path, &db);
+    if (rc != SQLITE_OK)
+    {
+        warnx("sqlite3_open(%s): %s", path, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return -1;
+    }
+
+    dw->db = db;
+    sqlite3_busy_handler(dw->db, _dw_busy, dw);
+
+    return 0;
+}
+
+/**
+ * \brief Open a read-only connection to the database at \p path for
+ * generating passphrases.
+ *
+ * The connection is opened without a mutex, since a handle is only used by one
+ * thread at a time, and reads the file through \c mmap. If \p flags contains
+ * #DW_OPEN_IMMUTABLE, or the file has no write permission bits, it is opened
+ * with the \c immutable URI parameter so that SQLite takes no locks at all.
+ */
+static int _dw_connect_ro(struct diceware *dw, const char *path,
+        unsigned flags)
+{
+    struct stat st;
+    sqlite3 *db;
+    const char *c;
+    char *uri, *p, *errmsg;
+    int rc;
+
+    if (!(flags & DW_OPEN_IMMUTABLE) && stat(path, &st) == 0
+            && (st.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH)) == 0)
+    {
+        flags |= DW_OPEN_IMMUTABLE;
+    }
+
+    /* Characters with a meaning in URIs have to be escaped in the path. */
+    uri = malloc(3 * strlen(path) + sizeof("file:?immutable=1"));
+    if (uri == NULL)
+    {
+        warn("malloc");
+        return -1;
+    }
+
+    p = uri + sprintf(uri, "file:");
+    for (c = path; *c != '\0'; c++)
+    {
+        if (*c == '%' || *c == '?' || *c == '#')
+        {
+            p += sprintf(p, "%%%02x", (unsigned char)*c);
+        }
+        else
+        {
+            *p++ = *c;
+        }
+    }
+    strcpy(p, flags & DW_OPEN_IMMUTABLE ? "?immutable=1" : "");
+
+    rc = sqlite3_open_v2(uri, &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX
+            | SQLITE_OPEN_URI, NULL);
+    free(uri);
+    if (rc != SQLITE_OK)
+    {
+        warnx("sqlite3_open_v2(%s): %s", path, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return -1;
+    }
+
+    dw->db = db;
+    sqlite3_busy_handler(dw->db, _dw_busy, dw);
+
+    rc = sqlite3_exec(dw->db, READ_MMAP, NULL, NULL, &errmsg);
+    if (rc != SQLITE_OK)
+    {
+        warnx("sqlite3_exec(%s): %s", READ_MMAP, errmsg);
+        sqlite3_free(errmsg);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Store a complete word table in the database of \p dw.
+ *
+ * \param dw Handle connected to the database to fill, with the size and
+ * number of dice of the list already set.
+ * \param words Packed, NUL-terminated words in slot order.
+ * \param offsets Offset of each word in \p words.
+ */
+static int _dw_store(struct diceware *dw, const char *words,
+        const uint32_t *offsets)
+{
+    sqlite3_int64 nobjects;
+    char *errmsg, *sql;
+    uint32_t i;
+    int rc;
+
+    /* A database that is being built from scratch has nothing to lose, so
+     * skip fsyncs and keep the rollback journal in memory. Lists added to a
+     * database that already holds others keep the safe defaults, so a crash
+     * cannot corrupt what is already stored.
+     */
+    if (_dw_query_ints(dw, &nobjects, 1, COUNT_OBJECTS, NULL) < 0)
+    {
+        return -1;
+    }
+    if (nobjects == 0)
+    {
+        rc = sqlite3_exec(dw->db, FAST_IMPORT, NULL, NULL, &errmsg);
+        if (rc != SQLITE_OK)
+        {
+            warnx("sqlite3_exec(%s): %s", FAST_IMPORT, errmsg);
+            sqlite3_free(errmsg);
+            return -1;
+        }
+    }
+
+    /* Start a new transaction that adds all tables and entries at once. These
+     * must be atomic since the generator expects exactly as many entries as
+     * recorded in the list's wordlist_info row.
+     */
+    rc = sqlite3_exec(dw->db, BEGIN_TRANSACTION, NULL, NULL, &errmsg);
+    if (rc != SQLITE_OK)
+    {
+        warnx("sqlite3_exec(%s): %s", BEGIN_TRANSACTION, errmsg);
+        sqlite3_free(errmsg);
+        return -1;
+    }
+
+    sql = sqlite3_mprintf(CREATE_TABLES CREATE_INFO SET_INFO, dw->table,
+            dw->table, dw->nwords, dw->ndice);
+    if (sql == NULL)
+    {
+        warnx("sqlite3_mprintf: out of memory");
+        rc = -1;
+    }
+    else
+    {
+        rc = sqlite3_exec(dw->db, sql, NULL, NULL, &errmsg);
+        if (rc != SQLITE_OK)
+        {
+            warnx("sqlite3_exec(%s): %s", sql, errmsg);
+            sqlite3_free(errmsg);
+            rc = -1;
+        }
+        sqlite3_free(sql);
+    }
+
+    for (i = 0; i < dw->nwords && rc == SQLITE_OK; i++)
+    {
+        rc = _dw_insert(dw, _dw_roll(dw, i), words + offsets[i],
+                offsets[i + 1] - offsets[i] - 1);
+    }
+
+    /* Index the words for reverse lookups once they are all in, which is
+     * cheaper than updating the index on every insert.
+     */
+    if (rc == SQLITE_OK)
+    {
+        sql = sqlite3_mprintf(CREATE_INDEX, dw->table, dw->table);
+        if (sql == NULL)
+        {
+            warnx("sqlite3_mprintf: out of memory");
+            rc = -1;
+        }
+        else
+        {
+            rc = sqlite3_exec(dw->db, sql, NULL, NULL, &errmsg);
+            if (rc != SQLITE_OK)
+            {
+                warnx("sqlite3_exec(%s): %s", sql, errmsg);
+                sqlite3_free(errmsg);
+                rc = -1;
+            }
+            sqlite3_free(sql);
+        }
+    }
+
+    if (rc < 0)
+    {
+        /* Rollback the transaction; we don't want an incomplete database. */
+        rc = sqlite3_exec(dw->db, UNDO_TRANSACTION, NULL, NULL, &errmsg);
+
+        /* Rollback failed; something has gone horribly wrong. */
+        if (rc != SQLITE_OK)
+        {
+            warnx("sqlite3_exec(%s): %s", UNDO_TRANSACTION, errmsg);
+            sqlite3_free(errmsg);
+        }
+
+        return -1;
+    }
+
+    /* Finished all diceware entries; attempt to commit the transaction. */
+    rc = sqlite3_exec(dw->db, END_TRANSACTION, NULL, NULL, &errmsg);
+
+    /* Commit to DB failed; return the error and let the higher layer handle
+     * it. */
+    if (rc != SQLITE_OK)
+    {
+        warnx("sqlite3_exec(%s): %s", END_TRANSACTION, errmsg);
+        sqlite3_free(errmsg);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void _dw_seen_free(struct diceware *dw)
+{
+    struct dw_seen *seen = dw->seen;
+
+    if (seen != NULL)
+    {
+        /* The keys are as secret as the passphrases they came from. */
+        explicit_bzero(seen->keys, (seen->mask + 1) * seen->keylen);
+        free(seen->keys);
+        free(seen->used);
+        pthread_mutex_destroy(&seen->lock);
+        free(seen);
+        dw->seen = NULL;
+    }
+}
+
+static void _dw_chars_free(struct diceware *dw)
+{
+    if (dw->chars != NULL)
+    {
+        free(dw->chars->count);
+        free(dw->chars);
+        dw->chars = NULL;
+    }
+}
+
+void dw_close(struct diceware *dw)
+{
+    if (dw->map != NULL)
+    {
+        munmap(dw->map, dw->maplen);
+    }
+    else if (!dw->builtin)
+    {
+        free((void *)dw->words);
+        free((void *)dw->offsets);
+    }
+
+    /* Don't leave unused random slots lying around in freed memory. */
+    explicit_bzero(dw->rng, sizeof(*dw->rng));
+    free(dw->rng);
+
+    if (dw->insert != NULL)
+    {
+        sqlite3_finalize(dw->insert);
+    }
+
+    if (dw->query != NULL)
+    {
+        sqlite3_finalize(dw->query);
+    }
+
+    if (dw->lookup != NULL)
+    {
+        sqlite3_finalize(dw->lookup);
+    }
+
+    if (dw->reverse != NULL)
+    {
+        sqlite3_finalize(dw->reverse);
+    }
+
+    free(dw->index_buf);
+    free(dw->by_len);
+    free(dw->len_start);
+    _dw_chars_free(dw);
+    _dw_seen_free(dw);
+    if (dw->deny != NULL)
+    {
+        denylist_close(dw->deny);
+        free(dw->deny);
+    }
+    sqlite3_free(dw->table);
+    sqlite3_close(dw->db);
+}
+
+/**
+ * \brief Finish opening \p dw once its word list is in place.
+ *
+ * Sets up the random pool for the size of the list and, if the list is in
+ * memory, sorts its slots into buckets by word length, so that length limits
+ * can later pick their words without scanning the list.
+ */
+static int _dw_ready(struct diceware *dw)
+{
+    uint32_t next[WORD_MAX + 2];
+    uint32_t i;
+    size_t len;
+
+    _dw_rng_init(dw->rng, dw->nwords);
+    dw->nsubset = dw->nwords;
+    if (dw->words == NULL)
+    {
+        return 0;
+    }
+
+    /* Words too long to import at all share the last bucket. */
+    dw->len_start = calloc(WORD_MAX + 3, sizeof(*dw->len_start));
+    dw->by_len = malloc((size_t)dw->nwords * sizeof(*dw->by_len));
+    if (dw->len_start == NULL || dw->by_len == NULL)
+    {
+        warn("malloc");
+        return -1;
+    }
+
+    for (i = 0; i < dw->nwords; i++)
+    {
+        len = dw->offsets[i + 1] - dw->offsets[i] - 1;
+        dw->len_start[(len <= WORD_MAX ? len : WORD_MAX + 1) + 1]++;
+    }
+    for (len = 1; len < WORD_MAX + 3; len++)
+    {
+        dw->len_start[len] += dw->len_start[len - 1];
+    }
+
+    memcpy(next, dw->len_start, sizeof(next));
+    for (i = 0; i < dw->nwords; i++)
+    {
+        len = dw->offsets[i + 1] - dw->offsets[i] - 1;
+        dw->by_len[next[len <= WORD_MAX ? len : WORD_MAX + 1]++] = i;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Apply the options in \p opts, if any, to the new handle \p dw.
+ */
+static int _dw_options(struct diceware *dw, const struct dw_options *opts)
+{
+    const char *c;
+    char *table;
+
+    if (opts == NULL)
+    {
+        return 0;
+    }
+
+    if (opts->busy_timeout != 0)
+    {
+        dw->busy_timeout = opts->busy_timeout;
+    }
+
+    if (opts->list != NULL)
+    {
+        /* Names end up in table names, so keep them to a safe alphabet. */
+        for (c = opts->list; *c != '\0'; c++)
+        {
+            if (!isalnum((unsigned char)*c) && *c != '_' && *c != '-')
+            {
+                break;
+            }
+        }
+        if (*c != '\0' || c == opts->list || c - opts->list > LIST_NAME_MAX)
+        {
+            warnx("invalid word list name: %s", opts->list);
+            return -1;
+        }
+
+        table = sqlite3_mprintf("%s_%s", DEFAULT_TABLE, opts->list);
+        if (table == NULL)
+        {
+            warnx("sqlite3_mprintf: out of memory");
+            return -1;
+        }
+        sqlite3_free(dw->table);
+        dw->table = table;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Create a new word database from a word list.
+ *
+ * Equivalent to #dw_create_v2() with default options.
+ */
+int dw_create(struct diceware *dw, const char *db_path, const char *word_path)
+{
+    return dw_create_v2(dw, db_path, word_path, NULL);
+}
+
+/**
+ * \brief Create a new word database from a word list, with the given options.
+ *
+ * The list at \p word_path is parsed and stored at \p db_path, either as an
+ * SQLite database or, if \p db_path ends in <tt>.dwl</tt>, as a compact word
+ * list. On success, \p dw is left open on the new list, and the time spent
+ * parsing and storing the list is recorded in it.
+ *
+ * \param dw Handle to initialize.
+ * \param db_path Path of the database or compact word list to create.
+ * \param word_path Path of the word list to import.
+ * \param opts Options for the new database, or \c NULL for the defaults.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dw_create_v2(struct diceware *dw, const char *db_path,
+        const char *word_path, const struct dw_options *opts)
+{
+    uint64_t start;
+    int rc;
+
+    rc = _dw_init(dw);
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    rc = _dw_options(dw, opts);
+    if (rc == 0 && dwl_is_path(db_path) && opts != NULL
+            && opts->list != NULL)
+    {
+        warnx("%s: compact word lists hold a single list", db_path);
+        rc = -1;
+    }
+    if (rc < 0)
+    {
+        dw_close(dw);
+        return -1;
+    }
+
+    start = _dw_now();
+    rc = _dw_parse(dw, word_path);
+    dw->parse_ns = _dw_now() - start;
+    if (rc == 0)
+    {
+        start = _dw_now();
+        if (dwl_is_path(db_path))
+        {
+            rc = dwl_write(db_path, dw->words, dw->offsets, dw->index,
+                    dw->nwords, dw->ndice);
+        }
+        else
+        {
+            rc = _dw_connect(dw, db_path);
+            if (rc == 0)
+            {
+                rc = _dw_store(dw, dw->words, dw->offsets);
+            }
+        }
+        dw->insert_ns = _dw_now() - start;
+    }
+
+    if (rc == 0)
+    {
+        rc = _dw_ready(dw);
+    }
+    if (rc < 0)
+    {
+        dw_close(dw);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Open an existing word database.
+ *
+ * Equivalent to #dw_open_v2() with default options.
+ */
+int dw_open(struct diceware *dw, const char *path)
+{
+    return dw_open_v2(dw, path, NULL);
+}
+
+/**
+ * \brief Open an existing word database with the given options.
+ *
+ * \p path may name either an SQLite database or a compact word list; the
+ * latter is recognized by its contents and mapped straight into memory.
+ *
+ * \param dw Handle to initialize.
+ * \param path Path to the database or compact word list.
+ * \param opts Options for opening the database, or \c NULL for the defaults.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dw_open_v2(struct diceware *dw, const char *path,
+        const struct dw_options *opts)
+{
+    struct dwl_map map;
+    unsigned flags;
+    uint64_t start;
+    int rc;
+
+    flags = opts != NULL ? opts->flags : 0;
+
+    start = _dw_now();
+    rc = _dw_init(dw);
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    rc = _dw_options(dw, opts);
+    if (rc == 0)
+    {
+        rc = dwl_map(path, &map);
+    }
+    if (rc > 0)
+    {
+        dw->map = map.base;
+        dw->maplen = map.len;
+        dw->words = map.words;
+        dw->offsets = map.offsets;
+        dw->nwords = map.nwords;
+        dw->ndice = map.ndice;
+        dw->index = map.index;
+
+        if (opts != NULL && opts->list != NULL)
+        {
+            warnx("%s: compact word lists hold a single list", path);
+            rc = -1;
+        }
+    }
+    else if (rc == 0)
+    {
+        rc = _dw_connect_ro(dw, path, flags);
+        if (rc == 0)
+        {
+            rc = _dw_shape(dw);
+        }
+        if (rc == 0 && !(flags & DW_OPEN_NOTABLE))
+        {
+            rc = _dw_load(dw);
+        }
+    }
+
+    if (rc >= 0)
+    {
+        rc = _dw_ready(dw);
+    }
+    if (rc < 0)
+    {
+        dw_close(dw);
+        return -1;
+    }
+
+    dw->open_ns = _dw_now() - start;
+    return 0;
+}
+
+/**
+ * \brief Open the word list compiled into the program.
+ *
+ * This needs no files and does not touch SQLite at all. It is only available
+ * when built with \c DICEWARE_BUILTIN_WORDLIST enabled.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dw_open_builtin(struct diceware *dw)
+{
+#ifdef DICEWARE_BUILTIN
+    uint64_t start;
+    int rc;
+
+    start = _dw_now();
+    rc = _dw_init(dw);
+    if (rc < 0)
+    {
+        return rc;
+    }
+
+    dw->words = dw_builtin_words;
+    dw->offsets = dw_builtin_offsets;
+    dw->nwords = dw_builtin_nwords;
+    dw->ndice = DEFAULT_DICE;
+    dw->index = dw_builtin_index;
+    dw->builtin = 1;
+    if (_dw_ready(dw) < 0)
+    {
+        dw_close(dw);
+        return -1;
+    }
+    dw->open_ns = _dw_now() - start;
+
+    return 0;
+#else
+    (void)dw;
+    warnx("not built with a builtin word list");
+    return -1;
+#endif
+}
+
+/**
+ * \brief Write the word list of \p dw to \p path.
+ *
+ * The list is written as a compact word list if \p path ends in
+ * <tt>.dwl</tt>, and as a new SQLite database otherwise, so this converts
+ * between the two formats.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dw_export(struct diceware *dw, const char *path)
+{
+    struct diceware out;
+    int rc;
+
+    if (dw->words == NULL)
+    {
+        warnx("word list is too large to export");
+        return -1;
+    }
+
+    if (dwl_is_path(path))
+    {
+        return dwl_write(path, dw->words, dw->offsets, dw->index, dw->nwords,
+                dw->ndice);
+    }
+
+    rc = _dw_init(&out);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    out.busy_timeout = dw->busy_timeout;
+    out.nwords = dw->nwords;
+    out.ndice = dw->ndice;
+
+    /* Keep the name of the list in the new database. */
+    sqlite3_free(out.table);
+    out.table = sqlite3_mprintf("%s", dw->table);
+    if (out.table == NULL)
+    {
+        warnx("sqlite3_mprintf: out of memory");
+        dw_close(&out);
+        return -1;
+    }
+
+    rc = _dw_connect(&out, path);
+    if (rc == 0)
+    {
+        rc = _dw_store(&out, dw->words, dw->offsets);
+    }
+
+    dw_close(&out);
+    return rc;
+}
+
+/**
+ * \brief Point \p out at \p output, with no buffer of its own yet.
+ *
+ * Output bypasses stdio and is written straight to the descriptor behind
+ * \p output, so anything already buffered in the stream is flushed first to
+ * keep it in order. Streams with no descriptor, such as memory streams, are
+ * still written with \c fwrite().
+ */
+static int _dw_outbuf_stream(struct dw_outbuf *out, FILE *output)
+{
+    out->output = output;
+    out->fd = -1;
+    out->fixed = 0;
+    out->data = NULL;
+    out->len = 0;
+    out->cap = 0;
+    out->written = 0;
+    out->ns = 0;
+
+    if (output != NULL)
+    {
+        if (fflush(output) != 0)
+        {
+            warn("fflush");
+            return -1;
+        }
+        out->fd = fileno(output);
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Set up an empty output buffer for \p output.
+ */
+static int _dw_outbuf_init(struct dw_outbuf *out, FILE *output)
+{
+    if (_dw_outbuf_stream(out, output) < 0)
+    {
+        return -1;
+    }
+
+    out->cap = OUTBUF_SIZE;
+    out->data = malloc(out->cap);
+    if (out->data == NULL)
+    {
+        warn("malloc");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Write all \p n buffers of \p iov to \p fd, retrying short writes.
+ */
+static int _dw_writev(int fd, struct iovec *iov, int n)
+{
+    ssize_t rc;
+    size_t left;
+
+    while (n > 0)
+    {
+        rc = writev(fd, iov, n);
+        if (rc < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (rc < 0)
+        {
+            warn("writev");
+            return -1;
+        }
+
+        /* Skip past whatever was written; writes to pipes may be short. */
+        for (left = rc; n > 0 && left >= iov->iov_len; iov++, n--)
+        {
+            left -= iov->iov_len;
+        }
+        if (n > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Write everything buffered in \p out, followed by \p len bytes of
+ * \p data, to the stream of \p out, counting the bytes and time taken.
+ *
+ * Both go out with a single \c writev() where possible, so large appends
+ * are never copied into the buffer first.
+ */
+static int _dw_write(struct dw_outbuf *out, const char *data, size_t len)
+{
+    struct iovec iov[2];
+    uint64_t start;
+    size_t total;
+
+    total = out->len + len;
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    start = _dw_now();
+    if (out->fd < 0)
+    {
+        if (fwrite(out->data, 1, out->len, out->output) != out->len
+                || fwrite(data, 1, len, out->output) != len)
+        {
+            warn("fwrite");
+            return -1;
+        }
+    }
+    else
+    {
+        iov[0].iov_base = out->data;
+        iov[0].iov_len = out->len;
+        iov[1].iov_base = (void *)data;
+        iov[1].iov_len = len;
+        if (_dw_writev(out->fd, iov, 2) < 0)
+        {
+            return -1;
+        }
+    }
+    out->ns += _dw_now() - start;
+    out->written += total;
+    out->len = 0;
+
+    return 0;
+}
+
+/**
+ * \brief Write everything buffered in \p out to its stream, if it has one.
+ */
+static int _dw_flush(struct dw_outbuf *out)
+{
+    if (out->output == NULL)
+    {
+        return 0;
+    }
+
+    return _dw_write(out, NULL, 0);
+}
+
+/**
+ * \brief Append \p len bytes of \p data to the output buffer.
+ *
+ * When the buffer fills up, it is written out to the stream together with
+ * \p data, or grown if the buffer has no stream.
+ */
+static int _dw_append(struct dw_outbuf *out, const char *data, size_t len)
+{
+    char *tmp;
+
+    if (out->len + len <= out->cap)
+    {
+        memcpy(out->data + out->len, data, len);
+        out->len += len;
+        return 0;
+    }
+    else if (out->output != NULL)
+    {
+        return _dw_write(out, data, len);
+    }
+    else if (out->fixed)
+    {
+        warnx("output buffer too small");
+        return -1;
+    }
+
+    tmp = realloc(out->data, 2 * (out->len + len));
+    if (tmp == NULL)
+    {
+        warn("realloc");
+        return -1;
+    }
+    out->data = tmp;
+    out->cap = 2 * (out->len + len);
+
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+
+    return 0;
+}
+
+static int _dw_text_word(const struct diceware *dw, struct dw_outbuf *out,
+        const char *word, size_t len, uint32_t slot, size_t i)
+{
+    (void)dw;
+    (void)slot;
+    (void)i;
+
+    if (_dw_append(out, word, len) < 0)
+    {
+        return -1;
+    }
+
+    return _dw_append(out, " ", 1);
+}
+
+static int _dw_text_end(const struct diceware *dw, struct dw_outbuf *out,
+        size_t nwords)
+{
+    (void)dw;
+    (void)nwords;
+
+    return _dw_append(out, "\n", 1);
+}
+
+/**
+ * \brief Check that the \p len bytes of \p word are valid UTF-8, which JSON
+ * strings must be.
+ *
+ * Overlong forms, surrogates and code points past U+10FFFF are rejected.
+ */
+static int _dw_utf8_valid(const char *word, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)word;
+    size_t i, k, n;
+    uint32_t cp, min;
+
+    for (i = 0; i < len; i += n)
+    {
+        if (p[i] < 0x80)
+        {
+            n = 1;
+            continue;
+        }
+        else if ((p[i] & 0xe0) == 0xc0)
+        {
+            n = 2;
+            cp = p[i] & 0x1f;
+            min = 0x80;
+        }
+        else if ((p[i] & 0xf0) == 0xe0)
+        {
+            n = 3;
+            cp = p[i] & 0x0f;
+            min = 0x800;
+        }
+        else if ((p[i] & 0xf8) == 0xf0)
+        {
+            n = 4;
+            cp = p[i] & 0x07;
+            min = 0x10000;
+        }
+        else
+        {
+            return 0;
+        }
+
+        if (n > len - i)
+        {
+            return 0;
+        }
+        for (k = 1; k < n; k++)
+        {
+            if ((p[i + k] & 0xc0) != 0x80)
+            {
+                return 0;
+            }
+            cp = cp << 6 | (p[i + k] & 0x3f);
+        }
+        if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * \brief Append \p word to \p out as the contents of a JSON string.
+ *
+ * The word must be valid UTF-8; only quotes, backslashes and control
+ * characters are escaped.
+ */
+static int _dw_append_json(struct dw_outbuf *out, const char *word,
+        size_t len)
+{
+    char esc[8];
+    size_t i, start;
+    int rc;
+
+    rc = 0;
+    for (i = start = 0; i < len && rc == 0; i++)
+    {
+        if (word[i] != '"' && word[i] != '\\'
+                && (unsigned char)word[i] >= 0x20)
+        {
+            continue;
+        }
+
+        snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)word[i]);
+        rc = _dw_append(out, word + start, i - start);
+        if (rc == 0)
+        {
+            rc = _dw_append(out, esc, 6);
+        }
+        start = i + 1;
+    }
+
+    if (rc == 0)
+    {
+        rc = _dw_append(out, word + start, len - start);
+    }
+    return rc;
+}
+
+/**
+ * Start of each JSON object written by #DW_FORMAT_JSONL, up to the opening
+ * quote of its first word.
+ */
+#define JSONL_START "{\"words\":[\""
+
+static int _dw_jsonl_word(const struct diceware *dw, struct dw_outbuf *out,
+        const char *word, size_t len, uint32_t slot, size_t i)
+{
+    char buf[sizeof(JSONL_START) + WORD_MAX + 1];
+    const char *sep;
+    size_t j, seplen;
+
+    (void)dw;
+
+    sep = i == 0 ? JSONL_START : ",\"";
+    seplen = i == 0 ? sizeof(JSONL_START) - 1 : 2;
+
+    /* Most words are plain ASCII that needs no escaping, and go out in a
+     * single append.
+     */
+    j = 0;
+    while (len <= WORD_MAX && j < len && word[j] != '"' && word[j] != '\\'
+            && (unsigned char)word[j] >= 0x20 && (unsigned char)word[j] < 0x80)
+    {
+        j++;
+    }
+    if (len <= WORD_MAX && j == len)
+    {
+        memcpy(buf, sep, seplen);
+        memcpy(buf + seplen, word, len);
+        buf[seplen + len] = '"';
+        return _dw_append(out, buf, seplen + len + 1);
+    }
+
+    if (!_dw_utf8_valid(word, len))
+    {
+        warnx("word %u is not valid UTF-8", slot);
+        return -1;
+    }
+
+    if (_dw_append(out, sep, seplen) < 0
+            || _dw_append_json(out, word, len) < 0)
+    {
+        return -1;
+    }
+
+    return _dw_append(out, "\"", 1);
+}
+
+static int _dw_jsonl_end(const struct diceware *dw, struct dw_outbuf *out,
+        size_t nwords)
+{
+    if (nwords == 0 && _dw_append(out, "{\"words\":[", 10) < 0)
+    {
+        return -1;
+    }
+
+    return _dw_append(out, dw->jsonl_end, strlen(dw->jsonl_end));
+}
+
+static int _dw_nul_word(const struct diceware *dw, struct dw_outbuf *out,
+        const char *word, size_t len, uint32_t slot, size_t i)
+{
+    (void)dw;
+    (void)slot;
+
+    if (i > 0 && _dw_append(out, " ", 1) < 0)
+    {
+        return -1;
+    }
+
+    return _dw_append(out, word, len);
+}
+
+static int _dw_nul_end(const struct diceware *dw, struct dw_outbuf *out,
+        size_t nwords)
+{
+    (void)dw;
+    (void)nwords;
+
+    return _dw_append(out, "", 1);
+}
+
+static int _dw_indices_word(const struct diceware *dw, struct dw_outbuf *out,
+        const char *word, size_t len, uint32_t slot, size_t i)
+{
+    unsigned char bytes[4];
+
+    (void)word;
+    (void)len;
+    (void)i;
+
+    bytes[0] = slot & 0xff;
+    bytes[1] = (slot >> 8) & 0xff;
+    bytes[2] = (slot >> 16) & 0xff;
+    bytes[3] = (slot >> 24) & 0xff;
+    return _dw_append(out, (const char *)bytes, dw->nwords <= 65536 ? 2 : 4);
+}
+
+static int _dw_indices_end(const struct diceware *dw, struct dw_outbuf *out,
+        size_t nwords)
+{
+    (void)dw;
+    (void)out;
+    (void)nwords;
+
+    return 0;
+}
+
+/**
+ * Writers for each #dw_format, in order.
+ */
+static const struct dw_writer _dw_writers[] =
+{
+    {1, _dw_text_word, _dw_text_end},
+    {1, _dw_jsonl_word, _dw_jsonl_end},
+    {1, _dw_nul_word, _dw_nul_end},
+    {0, _dw_indices_word, _dw_indices_end},
+};
+
+/**
+ * \brief Draw \p n slots of words allowed by the length limits of \p dw.
+ *
+ * The random pool draws positions among the allowed words, which are looked
+ * up in their length buckets, so every allowed word stays equally likely.
+ */
+static int _dw_draw(const struct diceware *dw, struct dw_rng *rng,
+        uint32_t *slots, size_t n)
+{
+    size_t i;
+
+    if (_dw_rng_slots(rng, slots, n) < 0)
+    {
+        return -1;
+    }
+
+    if (dw->subset != NULL)
+    {
+        for (i = 0; i < n; i++)
+        {
+            slots[i] = dw->subset[slots[i]];
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Draw a uniformly distributed number in [0, \p bound) straight from
+ * the system RNG, counting the call in \p rng.
+ */
+static int _dw_rng_below(struct dw_rng *rng, unsigned __int128 bound,
+        unsigned __int128 *x)
+{
+    unsigned __int128 limit;
+    uint64_t start;
+
+    limit = ~(unsigned __int128)0;
+    limit -= limit % bound;
+    do
+    {
+        start = _dw_now();
+        if (_dw_entropy(x, sizeof(*x)) < 0)
+        {
+            return -1;
+        }
+        rng->ns += _dw_now() - start;
+        rng->calls++;
+        rng->bytes += sizeof(*x);
+    }
+    while (*x >= limit);
+
+    *x %= bound;
+    return 0;
+}
+
+/**
+ * \brief Count the passphrases that fit the character limit of \p dw.
+ *
+ * For every number of words \c k and number of letters \c b, the count is
+ * the number of sequences of \c k allowed words with at most \c b letters
+ * between them, so that #_dw_chars_draw() can pick each word in proportion
+ * to the number of ways the passphrase can still be completed. Passphrases
+ * of \c k words only have <tt>k - 1</tt> fewer characters than the limit for
+ * their letters, so row \c k stops there. Rows stop altogether once a count
+ * no longer fits in 128 bits.
+ *
+ * The counts do not depend on the number of words in a passphrase, so they
+ * are only computed once for each set of limits.
+ */
+static int _dw_chars_build(struct diceware *dw)
+{
+    struct dw_chars *chars;
+    unsigned __int128 *count, *row, term;
+    unsigned budget, b, len;
+    uint32_t nlen;
+    size_t k, nrows, stride;
+
+    budget = dw->max_chars;
+    stride = budget + 1;
+    nrows = budget + 1 < PHRASE_SLOTS ? budget + 1 : PHRASE_SLOTS;
+
+    chars = malloc(sizeof(*chars));
+    count = calloc((nrows + 1) * stride, sizeof(*count));
+    if (chars == NULL || count == NULL)
+    {
+        warn("malloc");
+        free(chars);
+        free(count);
+        return -1;
+    }
+
+    for (b = 0; b <= budget; b++)
+    {
+        count[b] = 1;
+    }
+    for (k = 1; k <= nrows; k++)
+    {
+        row = &count[k * stride];
+        for (b = 0; b <= budget - (k - 1); b++)
+        {
+            for (len = dw->min_len; len <= dw->max_len && len <= b; len++)
+            {
+                nlen = dw->len_start[len + 1] - dw->len_start[len];
+                if (__builtin_mul_overflow(count[(k - 1) * stride + b - len],
+                            (unsigned __int128)nlen, &term)
+                        || __builtin_add_overflow(row[b], term, &row[b]))
+                {
+                    break;
+                }
+            }
+            if (len <= dw->max_len && len <= b)
+            {
+                break;
+            }
+        }
+        if (b <= budget - (k - 1))
+        {
+            nrows = k - 1;
+            break;
+        }
+    }
+
+    chars->nrows = nrows;
+    chars->budget = budget;
+    chars->count = count;
+    dw->chars = chars;
+    return 0;
+}
+
+/**
+ * \brief Return the number of passphrases of \p nwords words that fit the
+ * character limit, or 0 if none fit or there are too many to count.
+ */
+static unsigned __int128 _dw_chars_total(const struct dw_chars *chars,
+        size_t nwords)
+{
+    if (nwords > chars->nrows)
+    {
+        return 0;
+    }
+    else if (nwords == 0)
+    {
+        return 1;
+    }
+
+    return chars->count[nwords * (chars->budget + 1) + chars->budget
+        - (nwords - 1)];
+}
+
+/**
+ * \brief Make sure passphrases of \p nwords words can be drawn under the
+ * character limit of \p dw, if it has one.
+ */
+static int _dw_chars_prepare(struct diceware *dw, size_t nwords)
+{
+    if (dw->max_chars == 0)
+    {
+        return 0;
+    }
+    else if (dw->chars == NULL && _dw_chars_build(dw) < 0)
+    {
+        return -1;
+    }
+
+    if (nwords > PHRASE_SLOTS)
+    {
+        warnx("too many words for a character limit");
+        return -1;
+    }
+    else if (nwords > dw->chars->nrows && nwords - 1 <= dw->max_chars)
+    {
+        warnx("too many passphrases of %zu words fit the limits to count",
+                nwords);
+        return -1;
+    }
+    else if (_dw_chars_total(dw->chars, nwords) == 0)
+    {
+        warnx("no passphrase of %zu words fits in %u characters", nwords,
+                dw->max_chars);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Draw the slots of a whole passphrase that fits the character limit
+ * of \p dw, every such passphrase being equally likely.
+ *
+ * Each word is drawn in turn: one number below the count of passphrases that
+ * fit the remaining budget picks both the word's length, weighted by the
+ * number of ways to finish the passphrase after it, and the word among those
+ * of that length. No passphrase is ever drawn and thrown away.
+ */
+static int _dw_chars_draw(const struct diceware *dw, struct dw_rng *rng,
+        uint32_t *slots, size_t nwords)
+{
+    const struct dw_chars *chars = dw->chars;
+    unsigned __int128 r, rest, weight;
+    unsigned b, len;
+    size_t i, k, stride;
+
+    stride = chars->budget + 1;
+    b = chars->budget - (nwords - 1);
+    for (i = 0; i < nwords; i++)
+    {
+        k = nwords - i;
+        if (_dw_rng_below(rng, chars->count[k * stride + b], &r) < 0)
+        {
+            return -1;
+        }
+
+        rest = 0;
+        for (len = dw->min_len; len <= dw->max_len && len <= b; len++)
+        {
+            rest = chars->count[(k - 1) * stride + b - len];
+            weight = rest * (dw->len_start[len + 1] - dw->len_start[len]);
+            if (r < weight)
+            {
+                break;
+            }
+            r -= weight;
+        }
+
+        slots[i] = dw->by_len[dw->len_start[len] + (uint32_t)(r / rest)];
+        b -= len;
+    }
+
+    explicit_bzero(&r, sizeof(r));
+    return 0;
+}
+
+/**
+ * \brief Add the passphrase made of \p slots to the set of passphrases
+ * generated with \p dw, unless it is already there.
+ *
+ * \return Returns 1 if the passphrase is new, or 0 if it was generated before,
+ * which counts as a collision. If the set is full, prints an error message to
+ * stderr and returns -1.
+ */
+static int _dw_seen_add(struct diceware *dw, const uint32_t *slots)
+{
+    struct dw_seen *seen = dw->seen;
+    unsigned char key[(PHRASE_SLOTS * 32 + 7) / 8];
+    uint64_t acc, hash;
+    unsigned nbits;
+    size_t i, len, pos;
+    int rc;
+
+    /* Pack the slots little-endian, bits bits each. */
+    acc = 0;
+    nbits = 0;
+    len = 0;
+    for (i = 0; i < seen->nwords; i++)
+    {
+        acc |= (uint64_t)slots[i] << nbits;
+        for (nbits += seen->bits; nbits >= 8; nbits -= 8)
+        {
+            key[len++] = acc & 0xff;
+            acc >>= 8;
+        }
+    }
+    if (nbits > 0)
+    {
+        key[len++] = acc & 0xff;
+    }
+
+    /* FNV-1a */
+    hash = 0xcbf29ce484222325ull;
+    for (i = 0; i < len; i++)
+    {
+        hash = (hash ^ key[i]) * 0x100000001b3ull;
+    }
+
+    /* Checked before looking, or drawing again could go on forever once
+     * every passphrase has been generated.
+     */
+    pthread_mutex_lock(&seen->lock);
+    for (pos = hash & seen->mask; ; pos = (pos + 1) & seen->mask)
+    {
+        if (seen->size == seen->max)
+        {
+            warnx("more unique passphrases than reserved: %zu", seen->max);
+            rc = -1;
+            break;
+        }
+        else if (!(seen->used[pos / 8] & (1u << (pos % 8))))
+        {
+            memcpy(&seen->keys[pos * len], key, len);
+            seen->used[pos / 8] |= 1u << (pos % 8);
+            seen->size++;
+            rc = 1;
+            break;
+        }
+        else if (memcmp(&seen->keys[pos * len], key, len) == 0)
+        {
+            dw->collisions++;
+            rc = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&seen->lock);
+
+    explicit_bzero(key, sizeof(key));
+    return rc;
+}
+
+/**
+ * \brief Check the passphrase made of the \p n words in \p slots against the
+ * deny list of \p dw.
+ *
+ * The passphrase is hashed as it would be typed, with single spaces between
+ * the words, and each one found is counted in \p rng.
+ *
+ * \return Returns 1 if the passphrase may be used, or 0 if it is in the deny
+ * list. On failure, prints an error message to stderr and returns -1.
+ */
+static int _dw_deny_check(struct diceware *dw, struct dw_rng *rng,
+        const uint32_t *slots, size_t n)
+{
+    char phrase[PHRASE_SLOTS * (WORD_MAX + 1)];
+    char buf[WORD_MAX + 1];
+    uint8_t digest[SHA1_DIGEST_LENGTH];
+    const char *word;
+    size_t i, len, pos;
+    int rc;
+
+    rc = 1;
+    pos = 0;
+    for (i = 0; i < n && rc > 0; i++)
+    {
+        word = _dw_word(dw, slots[i], buf, sizeof(buf), &len);
+        if (word == NULL)
+        {
+            rc = -1;
+            break;
+        }
+        if (i > 0)
+        {
+            phrase[pos++] = ' ';
+        }
+        memcpy(phrase + pos, word, len);
+        pos += len;
+    }
+
+    if (rc > 0)
+    {
+        sha1(phrase, pos, digest);
+        if (denylist_contains(dw->deny, digest))
+        {
+            rng->rejects++;
+            rc = 0;
+        }
+    }
+
+    explicit_bzero(phrase, sizeof(phrase));
+    explicit_bzero(buf, sizeof(buf));
+    explicit_bzero(digest, sizeof(digest));
+    return rc;
+}
+
+/**
+ * \brief Generate a single passphrase of \p nwords words into \p out.
+ */
+static int _dw_phrase(struct diceware *dw, struct dw_rng *rng,
+        struct dw_outbuf *out, size_t nwords)
+{
+    size_t i, len;
+    uint32_t slots[PHRASE_SLOTS];
+    char buf[WORD_MAX + 1];
+    const struct dw_writer *writer = &_dw_writers[dw->format];
+    const char *word;
+    unsigned tries;
+    int rc;
+
+    /* Generate each word separately. */
+    for (i = 0; i < nwords; i++)
+    {
+        /* Draw the slots for the next few words in one go. */
+        if (i % PHRASE_SLOTS == 0)
+        {
+            len = nwords - i < PHRASE_SLOTS ? nwords - i : PHRASE_SLOTS;
+            tries = 0;
+            do
+            {
+                if (dw->chars != NULL
+                        ? _dw_chars_draw(dw, rng, slots, len) < 0
+                        : _dw_draw(dw, rng, slots, len) < 0)
+                {
+                    return -1;
+                }
+
+                /* Screened and unique passphrases have all their words drawn
+                 * at once. A passphrase is only remembered as generated once
+                 * it has passed the deny list.
+                 */
+                rc = 1;
+                if (dw->deny != NULL)
+                {
+                    rc = _dw_deny_check(dw, rng, slots, len);
+                    if (rc == 0 && ++tries == DENY_TRIES_MAX)
+                    {
+                        warnx("%d passphrases in a row were in the deny list",
+                                DENY_TRIES_MAX);
+                        return -1;
+                    }
+                }
+                if (rc > 0 && dw->seen != NULL)
+                {
+                    rc = _dw_seen_add(dw, slots);
+                }
+            }
+            while (rc == 0);
+
+            if (rc < 0)
+            {
+                return -1;
+            }
+        }
+
+        /* Look up the random word, unless only its slot is written, and
+         * append it to the output.
+         */
+        word = NULL;
+        len = 0;
+        if (writer->words)
+        {
+            word = _dw_word(dw, slots[i % PHRASE_SLOTS], buf, sizeof(buf),
+                    &len);
+            if (word == NULL)
+            {
+                return -1;
+            }
+        }
+
+        if (writer->word(dw, out, word, len, slots[i % PHRASE_SLOTS], i) < 0)
+        {
+            return -1;
+        }
+    }
+
+    return writer->end(dw, out, nwords);
+}
+
+/**
+ * \brief Generate \p count passphrases of \p nwords words into \p out, when
+ * the word list is only in the database.
+ *
+ * Rather than querying once per word, the words of consecutive passphrases are
+ * drawn and looked up #LOOKUP_SLOTS at a time, and split back into lines as
+ * they are written.
+ */
+static int _dw_phrases_db(struct diceware *dw, struct dw_rng *rng,
+        struct dw_outbuf *out, size_t nwords, size_t count)
+{
+    const struct dw_writer *writer = &_dw_writers[dw->format];
+    uint32_t slots[LOOKUP_SLOTS];
+    char words[LOOKUP_SLOTS][WORD_MAX + 1];
+    uint64_t total, done;
+    size_t i, n, pos;
+    int rc;
+
+    rc = 0;
+    pos = 0;
+    total = (uint64_t)nwords * count;
+    for (done = 0; done < total && rc == 0; done += n)
+    {
+        n = total - done < LOOKUP_SLOTS ? total - done : LOOKUP_SLOTS;
+        rc = _dw_rng_slots(rng, slots, n);
+        if (rc == 0 && writer->words)
+        {
+            rc = _dw_get_words(dw, slots, n, words);
+        }
+
+        for (i = 0; i < n && rc == 0; i++)
+        {
+            rc = writer->word(dw, out, words[i],
+                    writer->words ? strlen(words[i]) : 0, slots[i], pos);
+            if (rc == 0 && ++pos == nwords)
+            {
+                pos = 0;
+                rc = writer->end(dw, out, nwords);
+            }
+        }
+    }
+
+    explicit_bzero(slots, sizeof(slots));
+    explicit_bzero(words, sizeof(words));
+    return rc;
+}
+
+/**
+ * \brief Draw \p n uniformly distributed word slots.
+ *
+ * Each slot is in [0, \c dw->nwords) and is as likely as one picked by
+ * rolling dice; see #dw_word() to turn it into a word. Only words allowed by
+ * the word length limits set with #dw_set_limits() are drawn.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dw_sample(struct diceware *dw, uint32_t *slots, size_t n)
+{
+    int rc;
+
+    rc = _dw_draw(dw, dw->rng, slots, n);
+    _dw_rng_account(dw, dw->rng);
+
+    return rc;
+}
+
+/**
+ * \brief Restrict the passphrases generated with \p dw to those that fit
+ * \p limits.
+ *
+ * Word length limits narrow the list to the words with lengths in range, and
+ * a character limit restricts passphrases to those no longer than it, spaces
+ * included. Passphrases are still drawn uniformly from all those that fit,
+ * so #dw_entropy() gives their exact strength.
+ *
+ * \param dw Diceware database, which must hold its word list in memory.
+ * \param limits Limits to apply, replacing any set before.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1, leaving the previous limits in place.
+ */
+int dw_set_limits(struct diceware *dw, const struct dw_limits *limits)
+{
+    unsigned lo, hi;
+    uint32_t n;
+
+    if (dw->by_len == NULL)
+    {
+        warnx("length limits need the word list in memory");
+        return -1;
+    }
+
+    lo = limits->min_word_len > 1 ? limits->min_word_len : 1;
+    hi = limits->max_word_len > 0 && limits->max_word_len < WORD_MAX
+        ? limits->max_word_len : WORD_MAX;
+    if (lo > hi)
+    {
+        warnx("minimum word length is above the maximum");
+        return -1;
+    }
+    else if (limits->max_chars > CHARS_MAX)
+    {
+        warnx("character limit too large: %u", limits->max_chars);
+        return -1;
+    }
+
+    n = dw->len_start[hi + 1] - dw->len_start[lo];
+    if (n < 2)
+    {
+        warnx("fewer than two words are %u to %u characters long", lo, hi);
+        return -1;
+    }
+
+    dw->min_len = lo;
+    dw->max_len = hi;
+    dw->max_chars = limits->max_chars;
+    dw->nsubset = n;
+    dw->subset = n < dw->nwords ? dw->by_len + dw->len_start[lo] : NULL;
+    _dw_rng_init(dw->rng, n);
+    _dw_chars_free(dw);
+    dw->entropy = -1;
+
+    return 0;
+}
+
+/**
+ * \brief Compute the entropy of passphrases of \p nwords words generated with
+ * \p dw, in bits.
+ *
+ * This is the base 2 logarithm of the number of passphrases that can be
+ * generated, all of them being equally likely: the number of words allowed
+ * by the limits set with #dw_set_limits() to the power of \p nwords, or the
+ * exact number of those sequences that fit the character limit. The result
+ * is kept until the limits or \p nwords change, so calling this for every
+ * passphrase costs nothing.
+ *
+ * Passphrases removed by a deny list set with #dw_set_denylist() are not
+ * counted, so with one the result is only an upper bound.
+ *
+ * \return Returns the entropy. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+double dw_entropy(struct diceware *dw, size_t nwords)
+{
+    if (dw->entropy >= 0 && dw->entropy_nwords == nwords)
+    {
+        return dw->entropy;
+    }
+
+    if (_dw_chars_prepare(dw, nwords) < 0)
+    {
+        return -1;
+    }
+
+    if (dw->chars == NULL)
+    {
+        dw->entropy = nwords * log2(dw->nsubset);
+    }
+    else
+    {
+        dw->entropy = log2l(_dw_chars_total(dw->chars, nwords));
+    }
+    dw->entropy_nwords = nwords;
+
+    return dw->entropy;
+}
+
+/**
+ * \brief Find the fewest words a passphrase generated with \p dw needs to
+ * have at least \p bits bits of entropy.
+ *
+ * \param dw Diceware database, with any limits already set.
+ * \param bits Entropy to reach.
+ * \param nwords Set to the number of words.
+ *
+ * \return Returns 0 on success. If no passphrase that fits the limits is
+ * strong enough, or on failure, prints an error message to stderr and returns
+ * -1.
+ */
+int dw_words_for_bits(struct diceware *dw, double bits, size_t *nwords)
+{
+    double words;
+    size_t n;
+
+    if (dw->max_chars == 0)
+    {
+        /* Every word adds the same entropy; only rounding needs care. A list
+         * of one word adds none, which makes this infinite.
+         */
+        words = ceil(bits / log2(dw->nsubset));
+        if (!(words <= BITS_MAX_WORDS))
+        {
+            warnx("%g bits would take more than %d words", bits,
+                    BITS_MAX_WORDS);
+            return -1;
+        }
+
+        n = words;
+        while (n > 0 && (n - 1) * log2(dw->nsubset) >= bits)
+        {
+            n--;
+        }
+        while (n * log2(dw->nsubset) < bits)
+        {
+            n++;
+        }
+    }
+    else
+    {
+        if (dw->chars == NULL && _dw_chars_build(dw) < 0)
+        {
+            return -1;
+        }
+
+        /* More words can leave fewer passphrases that fit, so try them all. */
+        for (n = 0; n <= dw->chars->nrows; n++)
+        {
+            if (_dw_chars_total(dw->chars, n) > 0
+                    && log2l(_dw_chars_total(dw->chars, n)) >= bits)
+            {
+                break;
+            }
+        }
+        if (n > dw->chars->nrows)
+        {
+            warnx("no passphrase within the limits has %.2f bits", bits);
+            return -1;
+        }
+    }
+
+    *nwords = n;
+    return 0;
+}
+
+/**
+ * \brief Make every passphrase generated with \p dw from now on different
+ * from all the others.
+ *
+ * A set with room for \p count passphrases of \p nwords words is allocated
+ * up front. Each passphrase generated is checked against it, and one that
+ * was already generated is drawn again and counted in \c dw->collisions, so
+ * the passphrases are drawn uniformly without replacement. Generating more
+ * than \p count passphrases, or passphrases of another length, fails.
+ *
+ * \param dw Diceware database, with any limits already set.
+ * \param nwords Number of words in each passphrase.
+ * \param count Number of passphrases to make room for, or 0 to stop checking.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dw_set_unique(struct diceware *dw, size_t nwords, size_t count)
+{
+    struct dw_seen *seen;
+    unsigned __int128 total;
+    size_t i, nbuckets, size;
+
+    _dw_seen_free(dw);
+    if (count == 0)
+    {
+        return 0;
+    }
+    else if (nwords == 0 || nwords > PHRASE_SLOTS)
+    {
+        warnx("unique passphrases need 1 to %d words", PHRASE_SLOTS);
+        return -1;
+    }
+
+    if (dw_entropy(dw, nwords) < 0)
+    {
+        return -1;
+    }
+
+    /* Count exactly, so that asking for every passphrase is allowed. */
+    if (dw->chars != NULL)
+    {
+        total = _dw_chars_total(dw->chars, nwords);
+    }
+    else
+    {
+        total = 1;
+        for (i = 0; i < nwords && total < count; i++)
+        {
+            total *= dw->nsubset;
+        }
+    }
+    if (total < count)
+    {
+        warnx("only %.0f different passphrases of %zu words", (double)total,
+                nwords);
+        return -1;
+    }
+
+    /* Keep the table at most three quarters full. */
+    for (nbuckets = 1; nbuckets - nbuckets / 4 < count; nbuckets *= 2)
+    {
+        if (nbuckets > SIZE_MAX / 2)
+        {
+            warnx("too many unique passphrases: %zu", count);
+            return -1;
+        }
+    }
+
+    seen = calloc(1, sizeof(*seen));
+    if (seen == NULL)
+    {
+        warn("calloc");
+        return -1;
+    }
+
+    /* Slots are below nwords, so they fit in its bit length. */
+    for (seen->bits = 1; ((uint64_t)1 << seen->bits) < dw->nwords;
+            seen->bits++)
+    {
+    }
+    seen->nwords = nwords;
+    seen->keylen = (nwords * seen->bits + 7) / 8;
+    seen->mask = nbuckets - 1;
+    seen->max = count;
+
+    if (__builtin_mul_overflow(nbuckets, seen->keylen, &size)
+            || (seen->keys = malloc(size)) == NULL
+            || (seen->used = calloc((nbuckets + 7) / 8, 1)) == NULL)
+    {
+        warnx("cannot allocate room for %zu unique passphrases", count);
+        free(seen->keys);
+        free(seen);
+        return -1;
+    }
+
+    pthread_mutex_init(&seen->lock, NULL);
+    dw->seen = seen;
+    return 0;
+}
+
+/**
+ * \brief Never generate passphrases whose SHA-1 hash is in the file at
+ * \p path.
+ *
+ * The file holds raw 20-byte SHA-1 hashes in ascending order, as published
+ * for breached password corpora. It is mapped into memory and read once to
+ * build a Bloom filter. From then on, each passphrase generated is hashed as
+ * typed, with single spaces between its words. One found in the file is
+ * drawn again and counted in \c dw->rejections, so the passphrases remain
+ * uniformly distributed over those not in the file.
+ *
+ * \param dw Diceware database.
+ * \param path Path to the hash file, or \c NULL to stop checking.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dw_set_denylist(struct diceware *dw, const char *path)
+{
+    struct denylist *deny;
+
+    if (dw->deny != NULL)
+    {
+        denylist_close(dw->deny);
+        free(dw->deny);
+        dw->deny = NULL;
+    }
+    if (path == NULL)
+    {
+        return 0;
+    }
+
+    deny = malloc(sizeof(*deny));
+    if (deny == NULL)
+    {
+        warn("malloc");
+        return -1;
+    }
+    if (denylist_open(deny, path) < 0)
+    {
+        free(deny);
+        return -1;
+    }
+
+    dw->deny = deny;
+    return 0;
+}
+
+/**
+ * \brief Choose how passphrases generated with \p dw are written out.
+ *
+ * - #DW_FORMAT_TEXT writes each word followed by a space, and ends each
+ *   passphrase with a newline, as always.
+ * - #DW_FORMAT_JSONL writes each passphrase as a JSON object on a line of its
+ *   own, with its words in a \c words array and its entropy, as given by
+ *   #dw_entropy(), in \c bits. Every word must be valid UTF-8.
+ * - #DW_FORMAT_NUL separates the words with single spaces and ends each
+ *   passphrase with a NUL byte, for <tt>xargs -0</tt> and the like.
+ * - #DW_FORMAT_INDICES writes only the slot of each word, as a little-endian
+ *   integer of 2 bytes for lists of up to 65536 words or 4 bytes otherwise,
+ *   with nothing between them. The words are never looked up, so this suits
+ *   consumers that hold their own copy of the list.
+ *
+ * All formats are assembled in the same output buffer, and written in the
+ * same large blocks.
+ *
+ * \return Returns 0 on success. If \p format is not a known format, or the
+ * list has words that \p format cannot represent, prints an error message to
+ * stderr and returns -1.
+ */
+int dw_set_format(struct diceware *dw, enum dw_format format)
+{
+    uint32_t slot;
+
+    if ((unsigned)format >= sizeof(_dw_writers) / sizeof(_dw_writers[0]))
+    {
+        warnx("unknown output format: %d", (int)format);
+        return -1;
+    }
+
+    /* Catch words that cannot go in JSON before anything is written. Lists
+     * kept in the database are checked as their words are written instead.
+     */
+    if (format == DW_FORMAT_JSONL && dw->words != NULL)
+    {
+        for (slot = 0; slot < dw->nwords; slot++)
+        {
+            if (!_dw_utf8_valid(dw->words + dw->offsets[slot],
+                        dw->offsets[slot + 1] - dw->offsets[slot] - 1))
+            {
+                warnx("word %u is not valid UTF-8", slot);
+                return -1;
+            }
+        }
+    }
+
+    dw->format = format;
+    return 0;
+}
+
+/**
+ * \brief Look up the word in \p slot.
+ *
+ * \param dw Diceware database to use for words.
+ * \param slot Slot of the word, as returned by #dw_sample().
+ * \param buf Buffer for the word if it has to be copied out of the database.
+ * \param len Size of \p buf.
+ *
+ * \return Returns a pointer to the NUL-terminated word, which is only valid
+ * until the next lookup if it was copied into \p buf. On failure, prints an
+ * error message to stderr and returns \c NULL.
+ */
+const char *dw_word(struct diceware *dw, uint32_t slot, char *buf, size_t len)
+{
+    size_t wlen;
+
+    if (slot >= dw->nwords)
+    {
+        warnx("slot out of range: %u", slot);
+        return NULL;
+    }
+
+    dw->lookups++;
+    return _dw_word(dw, slot, buf, len, &wlen);
+}
+
+/**
+ * \brief Find \p word in an in-memory word table by binary search over its
+ * reverse index.
+ *
+ * \return Returns the slot of \p word, or -1 if it is not in the table.
+ */
+static int64_t _dw_search(const char *words, const uint32_t *offsets,
+        const uint32_t *index, uint32_t nwords, const char *word)
+{
+    uint32_t lo, hi, mid;
+    int cmp;
+
+    lo = 0;
+    hi = nwords;
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        cmp = strcmp(word, words + offsets[index[mid]]);
+        if (cmp == 0)
+        {
+            return index[mid];
+        }
+        else if (cmp < 0)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * \brief Find the slot of \p word, the inverse of #dw_word().
+ *
+ * In-memory tables are searched through their reverse index, which is stored
+ * alongside the list. Lists only in the database are looked up through the
+ * database's index on the words.
+ *
+ * \param dw Diceware database to use for words.
+ * \param word Word to look up.
+ * \param slot Set to the slot of \p word if it is found.
+ *
+ * \return Returns 1 if \p word is in the list, or 0 if it is not. On
+ * failure, prints an error message to stderr and returns -1.
+ */
+int dw_lookup_word(struct diceware *dw, const char *word, uint32_t *slot)
+{
+    int64_t found;
+    int rc;
+
+    dw->lookups++;
+    if (dw->words != NULL)
+    {
+        found = _dw_search(dw->words, dw->offsets, dw->index, dw->nwords,
+                word);
+        if (found < 0)
+        {
+            return 0;
+        }
+        *slot = found;
+        return 1;
+    }
+
+    if (dw->reverse == NULL)
+    {
+        if (_dw_prepare(dw, &dw->reverse, GET_SLOT, dw->table) < 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        sqlite3_reset(dw->reverse);
+    }
+
+    rc = sqlite3_bind_text(dw->reverse, 1, word, -1, SQLITE_STATIC);
+    if (rc != SQLITE_OK)
+    {
+        warnx("sqlite3_bind_text: %s", sqlite3_errstr(rc));
+        return -1;
+    }
+
+    rc = _dw_step(dw, dw->reverse);
+    if (rc == SQLITE_DONE)
+    {
+        return 0;
+    }
+    else if (rc != SQLITE_ROW)
+    {
+        warnx("sqlite3_step(%s): %s", sqlite3_sql(dw->reverse),
+                sqlite3_errmsg(dw->db));
+        return -1;
+    }
+
+    found = _dw_slot(dw, sqlite3_column_int64(dw->reverse, 0));
+    if (found < 0)
+    {
+        warnx("incomplete database");
+        return -1;
+    }
+    *slot = found;
+
+    return 1;
+}
+
+/**
+ * \brief Decode passphrases read from \p input, one per line, into the dice
+ * rolls that pick their words.
+ *
+ * For every line, writes the roll of each word (or its position, for lists
+ * not indexed by dice) to \p output, followed by the entropy of a passphrase
+ * of that many words drawn from the list. Lines with words that are not in
+ * the list are reported and skipped.
+ *
+ * \return Returns 0 if every line was decoded. Otherwise, prints an error
+ * message to stderr and returns -1.
+ */
+int dw_decode(struct diceware *dw, FILE *input, FILE *output)
+{
+    char *line, *word, *save;
+    uint32_t *slots, *tmp;
+    size_t cap, nslots, n, i;
+    int rc, found;
+
+    line = NULL;
+    cap = 0;
+    slots = NULL;
+    nslots = 0;
+    rc = 0;
+    found = 1;
+    while (found >= 0 && getline(&line, &cap, input) >= 0)
+    {
+        /* Look every word up before printing anything for the line. */
+        n = 0;
+        found = 1;
+        for (word = strtok_r(line, " \t\r\n", &save);
+                word != NULL && found == 1;
+                word = strtok_r(NULL, " \t\r\n", &save))
+        {
+            if (n == nslots)
+            {
+                tmp = realloc(slots, (2 * nslots + 16) * sizeof(*slots));
+                if (tmp == NULL)
+                {
+                    warn("realloc");
+                    found = -1;
+                    break;
+                }
+                slots = tmp;
+                nslots = 2 * nslots + 16;
+            }
+
+            found = dw_lookup_word(dw, word, &slots[n]);
+            if (found == 0)
+            {
+                warnx("unknown word: %s", word);
+            }
+            n += found == 1;
+        }
+
+        if (found != 1)
+        {
+            rc = -1;
+            continue;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            fprintf(output, "%s%u", i > 0 ? " " : "", _dw_roll(dw, slots[i]));
+        }
+        if (n > 0)
+        {
+            fprintf(output, "\t%.1f bits\n", dw_entropy(dw, n));
+        }
+    }
+
+    if (ferror(input))
+    {
+        warn("getline");
+        rc = -1;
+    }
+
+    /* The lines may well be real passphrases. */
+    if (line != NULL)
+    {
+        explicit_bzero(line, cap);
+    }
+    if (slots != NULL)
+    {
+        explicit_bzero(slots, nslots * sizeof(*slots));
+    }
+    free(line);
+    free(slots);
+
+    if (fflush(output) != 0 || ferror(output))
+    {
+        warn("fflush");
+        rc = -1;
+    }
+
+    return rc;
+}
+
+/**
+ * \brief Return the number of bits each word carries when encoding bytes with
+ * the list of \p dw.
+ *
+ * Only the first <tt>2^bits</tt> words of the list are used, so that every
+ * word stands for a whole number of bits.
+ */
+static unsigned _dw_codec_bits(const struct diceware *dw)
+{
+    unsigned bits;
+
+    for (bits = 0; (2u << bits) <= dw->nwords; bits++)
+    {
+    }
+
+    return bits;
+}
+
+/**
+ * \brief Append the word for \p value to the output of the encoder, starting
+ * a new line every #CODEC_LINE_WORDS words.
+ */
+static int _dw_codec_word(struct diceware *dw, struct dw_outbuf *out,
+        uint32_t value, uint64_t *nwords)
+{
+    char buf[WORD_MAX + 1];
+    const char *word;
+    size_t len;
+
+    word = _dw_word(dw, value, buf, sizeof(buf), &len);
+    if (word == NULL)
+    {
+        return -1;
+    }
+
+    if (*nwords > 0 && _dw_append(out,
+                *nwords % CODEC_LINE_WORDS == 0 ? "\n" : " ", 1) < 0)
+    {
+        return -1;
+    }
+    (*nwords)++;
+
+    return _dw_append(out, word, len);
+}
+
+/**
+ * \brief Encode the bytes read from \p input as words of the list of \p dw,
+ * written to \p output.
+ *
+ * The input is read as one stream of bits, most significant bit first, and
+ * cut into groups of as many bits as each word carries (see
+ * #_dw_codec_bits()); each group picks the word in that slot. The last group
+ * is padded with zero bits, and one more word gives the number of padding
+ * bits, so that #dw_decode_bytes() can restore the exact input. The words are
+ * separated by spaces, with #CODEC_LINE_WORDS words on each line.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dw_encode_bytes(struct diceware *dw, FILE *input, FILE *output)
+{
+    struct dw_outbuf out;
+    unsigned char *data;
+    uint64_t acc, mask, nwords;
+    unsigned bits, nbits, pad;
+    size_t n, i;
+    int rc;
+
+    bits = _dw_codec_bits(dw);
+    mask = ((uint64_t)1 << bits) - 1;
+
+    data = malloc(CODEC_READ_SIZE);
+    if (data == NULL)
+    {
+        warn("malloc");
+        return -1;
+    }
+
+    rc = _dw_outbuf_init(&out, output);
+    acc = 0;
+    nbits = 0;
+    nwords = 0;
+    while (rc == 0 && (n = fread(data, 1, CODEC_READ_SIZE, input)) > 0)
+    {
+        for (i = 0; i < n && rc == 0; i++)
+        {
+            acc = acc << 8 | data[i];
+            nbits += 8;
+            while (nbits >= bits && rc == 0)
+            {
+                nbits -= bits;
+                rc = _dw_codec_word(dw, &out, (acc >> nbits) & mask, &nwords);
+            }
+            acc &= ((uint64_t)1 << nbits) - 1;
+        }
+    }
+
+    if (rc == 0 && ferror(input))
+    {
+        warn("fread");
+        rc = -1;
+    }
+
+    /* Pad out the last group and say how many bits were padding. */
+    pad = nbits > 0 ? bits - nbits : 0;
+    if (rc == 0 && nbits > 0)
+    {
+        rc = _dw_codec_word(dw, &out, (acc << pad) & mask, &nwords);
+    }
+    if (rc == 0)
+    {
+        rc = _dw_codec_word(dw, &out, pad, &nwords);
+    }
+    if (rc == 0)
+    {
+        rc = _dw_append(&out, "\n", 1);
+    }
+    if (rc == 0)
+    {
+        rc = _dw_flush(&out);
+    }
+
+    dw->lookups += nwords;
+    dw->bytes_written += out.written;
+    dw->write_ns += out.ns;
+    explicit_bzero(data, CODEC_READ_SIZE);
+    free(data);
+    free(out.data);
+    return rc;
+}
+
+/**
+ * \brief Add the \p nbits low bits of \p value to the decoded bit stream,
+ * appending every completed byte to \p out.
+ */
+static int _dw_codec_push(struct dw_outbuf *out, uint64_t *acc,
+        unsigned *nbits, uint32_t value, unsigned nvalue)
+{
+    char byte;
+
+    *acc = *acc << nvalue | (value & (((uint64_t)1 << nvalue) - 1));
+    *nbits += nvalue;
+    while (*nbits >= 8)
+    {
+        *nbits -= 8;
+        byte = *acc >> *nbits;
+        if (_dw_append(out, &byte, 1) < 0)
+        {
+            return -1;
+        }
+    }
+    *acc &= ((uint64_t)1 << *nbits) - 1;
+
+    return 0;
+}
+
+/**
+ * \brief Decode words read from \p input, as written by #dw_encode_bytes(),
+ * back into bytes written to \p output.
+ *
+ * Words may be separated by any blanks or newlines. Each is found through the
+ * reverse index of the list; because the last word gives the padding of the
+ * word before it, the last two words are held back until the end of the
+ * input.
+ *
+ * \return Returns 0 on success. If the input is not a valid encoding, or on
+ * any other failure, prints an error message to stderr and returns -1.
+ */
+int dw_decode_bytes(struct diceware *dw, FILE *input, FILE *output)
+{
+    struct dw_outbuf out;
+    char *line, *word, *save;
+    uint32_t held[2], slot;
+    uint64_t acc;
+    unsigned bits, nbits, nheld;
+    size_t cap;
+    int rc, found;
+
+    bits = _dw_codec_bits(dw);
+
+    rc = _dw_outbuf_init(&out, output);
+    line = NULL;
+    cap = 0;
+    acc = 0;
+    nbits = 0;
+    nheld = 0;
+    while (rc == 0 && getline(&line, &cap, input) >= 0)
+    {
+        for (word = strtok_r(line, " \t\r\n", &save);
+                word != NULL && rc == 0;
+                word = strtok_r(NULL, " \t\r\n", &save))
+        {
+            found = dw_lookup_word(dw, word, &slot);
+            if (found <= 0 || slot >> bits != 0)
+            {
+                if (found == 0 || found == 1)
+                {
+                    warnx("invalid word in encoding: %s", word);
+                }
+                rc = -1;
+                break;
+            }
+
+            /* Every word but the last two carries only data bits. */
+            if (nheld == 2)
+            {
+                rc = _dw_codec_push(&out, &acc, &nbits, held[0], bits);
+                held[0] = held[1];
+                nheld--;
+            }
+            held[nheld++] = slot;
+        }
+    }
+
+    if (rc == 0 && ferror(input))
+    {
+        warn("getline");
+        rc = -1;
+    }
+
+    /* The last word gives the padding at the end of the one before it. */
+    if (rc == 0 && nheld == 2 && held[1] < bits
+            && (held[0] & (((uint32_t)1 << held[1]) - 1)) == 0)
+    {
+        rc = _dw_codec_push(&out, &acc, &nbits, held[0] >> held[1],
+                bits - held[1]);
+    }
+    else if (rc == 0 && !(nheld == 1 && held[0] == 0))
+    {
+        warnx("invalid encoding");
+        rc = -1;
+    }
+
+    if (rc == 0 && nbits != 0)
+    {
+        warnx("invalid encoding");
+        rc = -1;
+    }
+    if (rc == 0)
+    {
+        rc = _dw_flush(&out);
+    }
+
+    dw->bytes_written += out.written;
+    dw->write_ns += out.ns;
+    if (line != NULL)
+    {
+        explicit_bzero(line, cap);
+    }
+    free(line);
+    free(out.data);
+    return rc;
+}
+
+/**
+ * \brief Generate a diceware passphrase.
+ *
+ * Using the diceware database \p dw, generate a passphrase using \p nwords
+ * words, printing the result top output. If any errors occurs, returns -1.
+ * Else, returns 0. Note that the underlying RNG is the cryptographically-secure
+ * BSD \c arc4random_buf function (or \c getrandom, if built with
+ * \c DICEWARE_GETRANDOM), read a few kilobytes at a time.
+ *
+ * \param dw Diceware database to use for words.
+ * \param output File stream to which the result is written.
+ * \param nwords Number of words to use for the passphrase.
+ *
+ * \return Returns 0 on successful generation. On failure, prints an error
+ * message to stderr and returns -1.
+ */
+int dw_generate(struct diceware *dw, FILE *output, size_t nwords)
+{
+    return dw_generate_batch(dw, output, nwords, 1);
+}
+
+/**
+ * \brief Get \p dw ready to generate passphrases of \p nwords words under its
+ * current settings.
+ */
+static int _dw_setup(struct diceware *dw, size_t nwords)
+{
+    double entropy;
+
+    entropy = dw_entropy(dw, nwords);
+    if (entropy < 0)
+    {
+        return -1;
+    }
+    snprintf(dw->jsonl_end, sizeof(dw->jsonl_end), "],\"bits\":%.2f}\n",
+            entropy);
+
+    if (dw->seen != NULL && dw->seen->nwords != nwords)
+    {
+        warnx("unique passphrases were set up for %zu words",
+                dw->seen->nwords);
+        return -1;
+    }
+    else if (dw->deny != NULL && nwords > PHRASE_SLOTS)
+    {
+        warnx("too many words to check against the deny list");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Generate \p count passphrases of \p nwords words into \p out,
+ * counting the work in \p dw.
+ */
+static int _dw_generate(struct diceware *dw, struct dw_outbuf *out,
+        size_t nwords, size_t count)
+{
+    size_t i;
+    int rc;
+
+    if (_dw_setup(dw, nwords) < 0)
+    {
+        return -1;
+    }
+
+    /* Unique and screened passphrases are checked one at a time. */
+    rc = 0;
+    if (dw->words == NULL && nwords > 0 && dw->seen == NULL
+            && dw->deny == NULL)
+    {
+        rc = _dw_phrases_db(dw, dw->rng, out, nwords, count);
+        i = rc == 0 ? count : 0;
+    }
+    else
+    {
+        for (i = 0; i < count && rc == 0; i++)
+        {
+            rc = _dw_phrase(dw, dw->rng, out, nwords);
+        }
+    }
+
+    if (rc == 0)
+    {
+        rc = _dw_flush(out);
+    }
+
+    _dw_rng_account(dw, dw->rng);
+    dw->lookups += i * nwords;
+    dw->bytes_written += out->written;
+    dw->write_ns += out->ns;
+    return rc;
+}
+
+/**
+ * \brief Generate many diceware passphrases, one per line.
+ *
+ * Behaves like #dw_generate() called \p count times, but reuses the open
+ * database and assembles the output in a buffer, which is written to the
+ * descriptor behind \p output in large blocks instead of one call per word.
+ *
+ * \param dw Diceware database to use for words.
+ * \param output File stream to which the results are written.
+ * \param nwords Number of words to use for each passphrase.
+ * \param count Number of passphrases to generate.
+ *
+ * \return Returns 0 on successful generation. On failure, prints an error
+ * message to stderr and returns -1.
+ */
+int dw_generate_batch(struct diceware *dw, FILE *output, size_t nwords,
+        size_t count)
+{
+    struct dw_outbuf out;
+    uint64_t start;
+    int rc;
+
+    start = _dw_now();
+    rc = _dw_outbuf_init(&out, output);
+    if (rc == 0)
+    {
+        rc = _dw_generate(dw, &out, nwords, count);
+    }
+
+    dw->generate_ns += _dw_now() - start;
+    free(out.data);
+    return rc;
+}
+
+/**
+ * \brief Generate diceware passphrases, one per line, into the caller's
+ * buffer \p buf.
+ *
+ * This is #dw_generate_batch() without any stream: the output is written
+ * straight into \p buf and NUL-terminated.
+ *
+ * \param dw Diceware database to use for words.
+ * \param buf Buffer receiving the passphrases.
+ * \param cap Size of \p buf, including room for the terminating NUL.
+ * \param len If not \c NULL, set to the length of the output on success.
+ * \param nwords Number of words to use for each passphrase.
+ * \param count Number of passphrases to generate.
+ *
+ * \return Returns 0 on successful generation. If the passphrases do not fit
+ * in \p buf, or on any other failure, clears \p buf, prints an error message
+ * to stderr and returns -1.
+ */
+int dw_generate_mem(struct diceware *dw, char *buf, size_t cap, size_t *len,
+        size_t nwords, size_t count)
+{
+    struct dw_outbuf out;
+    uint64_t start;
+    int rc;
+
+    if (cap == 0)
+    {
+        warnx("output buffer too small");
+        return -1;
+    }
+
+    start = _dw_now();
+    _dw_outbuf_stream(&out, NULL);
+    out.fixed = 1;
+    out.data = buf;
+    out.cap = cap - 1;
+
+    rc = _dw_generate(dw, &out, nwords, count);
+    dw->bytes_written += out.len;
+    dw->generate_ns += _dw_now() - start;
+    if (rc < 0)
+    {
+        explicit_bzero(buf, cap);
+        return -1;
+    }
+
+    buf[out.len] = '\0';
+    if (len != NULL)
+    {
+        *len = out.len;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Body of a worker thread for #dw_generate_parallel().
+ *
+ * Generates chunks id, id + nthreads, id + 2 * nthreads, ... into the worker's
+ * private buffer using its private random stream, handing each one to the
+ * writer and waiting for it to be drained before starting the next.
+ */
+static void *_dw_worker(void *arg)
+{
+    struct dw_worker *worker = arg;
+    struct dw_job *job = worker->job;
+    size_t chunk, i, n;
+    int rc, stop;
+
+    for (chunk = worker->id; chunk < job->nchunks; chunk += job->nthreads)
+    {
+        pthread_mutex_lock(&job->lock);
+        while (worker->full && !job->abort)
+        {
+            pthread_cond_wait(&job->cond, &job->lock);
+        }
+        stop = job->abort;
+        pthread_mutex_unlock(&job->lock);
+
+        if (stop)
+        {
+            break;
+        }
+
+        n = job->count - chunk * CHUNK_PHRASES;
+        if (n > CHUNK_PHRASES)
+        {
+            n = CHUNK_PHRASES;
+        }
+
+        worker->out.len = 0;
+        rc = 0;
+        for (i = 0; i < n && rc == 0; i++)
+        {
+            rc = _dw_phrase(job->dw, &worker->rng, &worker->out,
+                    job->nwords);
+        }
+
+        pthread_mutex_lock(&job->lock);
+        worker->full = 1;
+        worker->error = rc < 0;
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->lock);
+
+        if (rc < 0)
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * \brief Generate many diceware passphrases using several threads.
+ *
+ * Worker threads share the in-memory word table of \p dw and each draw from
+ * their own random stream, filling private buffers of #CHUNK_PHRASES
+ * passphrases. The calling thread writes the chunks to \p output in order, so
+ * lines never interleave. If the word table is not in memory, the SQLite
+ * statements cannot be shared and this falls back to #dw_generate_batch().
+ *
+ * \param dw Diceware database to use for words.
+ * \param output File stream to which the results are written.
+ * \param nwords Number of words to use for each passphrase.
+ * \param count Number of passphrases to generate.
+ * \param nthreads Number of worker threads to use.
+ *
+ * \return Returns 0 on successful generation. On failure, prints an error
+ * message to stderr and returns -1.
+ */
+int dw_generate_parallel(struct diceware *dw, FILE *output, size_t nwords,
+        size_t count, unsigned nthreads)
+{
+    struct dw_job job;
+    struct dw_worker *workers, *worker;
+    struct dw_outbuf sink;
+    size_t chunk, n;
+    uint64_t start;
+    unsigned i, started;
+    int rc;
+
+    job.nchunks = (count + CHUNK_PHRASES - 1) / CHUNK_PHRASES;
+    if (nthreads > job.nchunks)
+    {
+        nthreads = job.nchunks;
+    }
+
+    if (nthreads <= 1 || dw->words == NULL)
+    {
+        return dw_generate_batch(dw, output, nwords, count);
+    }
 
-    if (dw->query == NULL)
+    /* Workers share the counts, so they must be ready before they start. */
+    if (_dw_setup(dw, nwords) < 0)
     {
-        rc = sqlite3_prepare_v2(dw->db, GET_WORD, -1, &dw->query, NULL);
-        if (rc != SQLITE_OK)
-        {
-            warnx("sqlite3_prepare_v2(%s): %s", GET_WORD,
-                    sqlite3_errmsg(dw->db));
-            return -1;
-        }
+        return -1;
     }
-    else
+
+    start = _dw_now();
+    if (_dw_outbuf_stream(&sink, output) < 0)
     {
-        sqlite3_reset(dw->query);
+        return -1;
     }
 
-    rc = sqlite3_bind_int(dw->query, 1, idx);
-    if (rc != SQLITE_OK)
+    workers = calloc(nthreads, sizeof(*workers));
+    if (workers == NULL)
     {
-        warnx("sqlite3_bind_int: %s", sqlite3_errstr(rc));
+        warn("calloc");
         return -1;
     }
 
-    do
+    job.dw = dw;
+    job.nwords = nwords;
+    job.count = count;
+    job.nthreads = nthreads;
+    job.abort = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+
+    rc = 0;
+    for (started = 0; started < nthreads; started++)
     {
-        rc = sqlite3_step(dw->query);
-    } while (rc == SQLITE_BUSY);
+        worker = &workers[started];
+        worker->job = &job;
+        worker->id = started;
+        _dw_rng_init(&worker->rng, dw->nsubset);
+        if (_dw_outbuf_init(&worker->out, NULL) < 0)
+        {
+            rc = -1;
+            break;
+        }
 
-    if (rc != SQLITE_ROW)
+        errno = pthread_create(&worker->thread, NULL, _dw_worker, worker);
+        if (errno != 0)
+        {
+            warn("pthread_create");
+            free(worker->out.data);
+            rc = -1;
+            break;
+        }
+    }
+
+    /* Drain the chunks in order, waiting for each one's worker to finish it. */
+    for (chunk = 0; chunk < job.nchunks && rc == 0; chunk++)
     {
-        if (rc == SQLITE_DONE)
+        worker = &workers[chunk % nthreads];
+
+        pthread_mutex_lock(&job.lock);
+        while (!worker->full)
         {
-            warnx("incomplete database");
+            pthread_cond_wait(&job.cond, &job.lock);
         }
-        else
+        pthread_mutex_unlock(&job.lock);
+
+        if (worker->error)
         {
-            warnx("sqlite3_step(%s): %s", GET_WORD, sqlite3_errmsg(dw->db));
+            rc = -1;
+            break;
         }
-        return -1;
+
+        /* Chunks go out as they are, without copying them into a buffer. */
+        if (_dw_write(&sink, worker->out.data, worker->out.len) < 0)
+        {
+            rc = -1;
+            break;
+        }
+
+        n = count - chunk * CHUNK_PHRASES;
+        dw->lookups += (n < CHUNK_PHRASES ? n : CHUNK_PHRASES) * nwords;
+
+        pthread_mutex_lock(&job.lock);
+        worker->full = 0;
+        pthread_cond_broadcast(&job.cond);
+        pthread_mutex_unlock(&job.lock);
     }
 
-    word = (const char *)sqlite3_column_text(dw->query, 0);
-    if (word == NULL)
+    pthread_mutex_lock(&job.lock);
+    job.abort = rc < 0;
+    pthread_cond_broadcast(&job.cond);
+    pthread_mutex_unlock(&job.lock);
+
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        _dw_rng_wipe(dw, &workers[i].rng);
+        free(workers[i].out.data);
+    }
+
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.lock);
+    free(workers);
+
+    dw->bytes_written += sink.written;
+    dw->write_ns += sink.ns;
+    dw->generate_ns += _dw_now() - start;
+    return rc;
+}
+
+/**
+ * \brief Move the in-memory word table of the open handle \p dw into
+ * \p table, and close \p dw.
+ */
+static int _dw_table_take(struct dw_table *table, struct diceware *dw)
+{
+    if (dw->words == NULL)
     {
-        warnx("sqlite3_column_text(%s): %s", GET_WORD, sqlite3_errmsg(dw->db));
+        warnx("word list is too large to share");
+        dw_close(dw);
         return -1;
     }
 
-    strncpy(out, word, len);
+    table->words = dw->words;
+    table->offsets = dw->offsets;
+    table->index = dw->index;
+    table->index_buf = dw->index_buf;
+    table->nwords = dw->nwords;
+    table->ndice = dw->ndice;
+    table->map = dw->map;
+    table->maplen = dw->maplen;
+    table->builtin = dw->builtin;
+
+    /* The table now owns the words; keep dw_close() from releasing them. */
+    dw->words = NULL;
+    dw->offsets = NULL;
+    dw->index_buf = NULL;
+    dw->map = NULL;
+    dw_close(dw);
 
     return 0;
 }
 
-static int _dw_insert(struct diceware *dw, int index, const char *word)
+/**
+ * \brief Open the word list at \p path as a table that can be shared between
+ * threads.
+ *
+ * The list is read into memory and the database is closed again, so the table
+ * holds no SQLite state and is never modified until #dw_table_close(). It
+ * accepts the same files and options as #dw_open_v2(), except that lists too
+ * large to keep in memory cannot be opened this way.
+ *
+ * \param table Table to initialize.
+ * \param path Path to the database or compact word list.
+ * \param opts Options for opening the database, or \c NULL for the defaults.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dw_table_open(struct dw_table *table, const char *path,
+        const struct dw_options *opts)
 {
-    int rc;
+    struct diceware dw;
+    struct dw_options o;
 
-    if (dw->insert == NULL)
-    {
-        rc = sqlite3_prepare_v2(dw->db, INSERT_WORD, -1, &dw->insert, NULL);
-        if (rc != SQLITE_OK)
-        {
-            warnx("sqlite3_prepare_v2(%s): %s", INSERT_WORD,
-                    sqlite3_errmsg(dw->db));
-            return -1;
-        }
-    }
-    else
+    /* Loading the table is the whole point, whatever the caller asked. */
+    memset(&o, 0, sizeof(o));
+    if (opts != NULL)
     {
-        sqlite3_reset(dw->insert);
+        o = *opts;
     }
+    o.flags &= ~DW_OPEN_NOTABLE;
 
-    rc = sqlite3_bind_int(dw->insert, 1, index);
-    if (rc != SQLITE_OK)
+    if (dw_open_v2(&dw, path, &o) < 0)
     {
-        warnx("sqlite3_bind_int: %s", sqlite3_errstr(rc));
         return -1;
     }
 
-    rc = sqlite3_bind_text(dw->insert, 2, word, -1, SQLITE_STATIC);
-    if (rc != SQLITE_OK)
+    return _dw_table_take(table, &dw);
+}
+
+/**
+ * \brief Open the word list compiled into the program as a shareable table.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dw_table_open_builtin(struct dw_table *table)
+{
+    struct diceware dw;
+
+    if (dw_open_builtin(&dw) < 0)
     {
-        warnx("sqlite3_bind_text: %s", sqlite3_errstr(rc));
         return -1;
     }
 
-    do
+    return _dw_table_take(table, &dw);
+}
+
+/**
+ * \brief Release the word table held by \p table.
+ *
+ * No generator context may still be using it.
+ */
+void dw_table_close(struct dw_table *table)
+{
+    free(table->index_buf);
+    if (table->map != NULL)
+    {
+        munmap(table->map, table->maplen);
+    }
+    else if (!table->builtin)
     {
-        rc = sqlite3_step(dw->insert);
-    } while (rc == SQLITE_BUSY);
+        free((void *)table->words);
+        free((void *)table->offsets);
+    }
+}
 
-    if (rc != SQLITE_DONE)
+/**
+ * \brief Set up the generator context \p ctx for drawing passphrases from
+ * \p table.
+ *
+ * Each thread needs its own context; any number of contexts may share one
+ * table. The context holds the thread's private random stream, so generating
+ * needs no locks and no further allocation.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dw_gen_init(struct dw_gen *ctx, const struct dw_table *table)
+{
+    ctx->rng = malloc(sizeof(*ctx->rng));
+    if (ctx->rng == NULL)
     {
-        warnx("sqlite3_step(%s): %s", GET_WORD, sqlite3_errmsg(dw->db));
+        warn("malloc");
         return -1;
     }
 
+    _dw_rng_init(ctx->rng, table->nwords);
+    ctx->table = table;
+
     return 0;
 }
 
-static int _dw_populate(struct diceware *dw, const char *path)
+/**
+ * \brief Release the generator context \p ctx, wiping its unused random
+ * slots.
+ */
+void dw_gen_free(struct dw_gen *ctx)
+{
+    explicit_bzero(ctx->rng, sizeof(*ctx->rng));
+    free(ctx->rng);
+    ctx->rng = NULL;
+}
+
+/**
+ * \brief Generate a passphrase of \p nwords words into \p out.
+ *
+ * The words are separated by single spaces and the result is NUL-terminated,
+ * with no newline. Only the word table and \p ctx are used, so threads with
+ * their own contexts can call this at the same time; nothing is allocated.
+ *
+ * \param ctx Generator context of the calling thread.
+ * \param out Buffer receiving the passphrase.
+ * \param cap Size of \p out, including room for the terminating NUL.
+ * \param nwords Number of words to use for the passphrase.
+ *
+ * \return Returns 0 on success. If the passphrase does not fit in \p out, or
+ * on any other failure, clears \p out, prints an error message to stderr and
+ * returns -1.
+ */
+int dw_generate_buf(struct dw_gen *ctx, char *out, size_t cap, size_t nwords)
 {
-    FILE *input;
-    int index;
-    char word[64];
-    int rc, count;
+    const struct dw_table *table = ctx->table;
+    uint32_t slots[PHRASE_SLOTS];
+    size_t i, n, len, used;
+    uint32_t slot;
+    int rc;
 
-    /* Open the input file, checking for errors. */
-    input = fopen(path, "r");
-    if (input == NULL)
+    if (cap == 0)
     {
-        warn("fopen(%s)", path);
+        warnx("output buffer too small");
         return -1;
     }
 
-    count = 0;
-    for (;;)
+    rc = 0;
+    used = 0;
+    for (i = 0; i < nwords && rc == 0; i++)
     {
-        /* If can't scan the correct input, then the parser has failed. */
-        rc = fscanf(input, "%d %63s", &index, word);
-        if (rc == 2)
+        /* Draw the slots for the next few words in one go. */
+        if (i % PHRASE_SLOTS == 0)
         {
-            /* Attempt to insert the new database entry; break on failure. */
-            rc = _dw_insert(dw, index, word);
-            if (rc == 0)
-            {
-                count++;
-            }
-            else
+            n = nwords - i < PHRASE_SLOTS ? nwords - i : PHRASE_SLOTS;
+            rc = _dw_rng_slots(ctx->rng, slots, n);
+            if (rc < 0)
             {
                 break;
             }
         }
-        else
+
+        slot = slots[i % PHRASE_SLOTS];
+        len = table->offsets[slot + 1] - table->offsets[slot] - 1;
+        if (used + (i > 0) + len >= cap)
         {
+            warnx("output buffer too small");
+            rc = -1;
             break;
         }
-    }
 
-    /* Input file was not complete/some other error occurred. */
-    if (count < 7776)
-    {
-        /* Figure out which error occurred and log the appropriate message. */
-        if (ferror(input))
-        {
-            warn("fscanf(%s)", path);
-        }
-        else if (feof(input))
+        if (i > 0)
         {
-            warnx("too few diceware entries: %s", path);
-        }
-        else
-        {
-            warnx("invalid diceware file: %s", path);
+            out[used++] = ' ';
         }
+        memcpy(out + used, table->words + table->offsets[slot], len);
+        used += len;
+    }
 
+    explicit_bzero(slots, sizeof(slots));
+    if (rc < 0)
+    {
+        explicit_bzero(out, cap);
         return -1;
     }
+
+    out[used] = '\0';
     return 0;
 }
 
-void dw_close(struct diceware *dw)
+/**
+ * \brief Find the slot of \p word in \p table, like #dw_lookup_word().
+ *
+ * \return Returns 1 and sets \p slot if \p word is in the table, or 0 if it
+ * is not.
+ */
+int dw_table_lookup(const struct dw_table *table, const char *word,
+        uint32_t *slot)
 {
-    if (dw->insert != NULL)
-    {
-        sqlite3_finalize(dw->insert);
-    }
+    int64_t found;
 
-    if (dw->query != NULL)
+    found = _dw_search(table->words, table->offsets, table->index,
+            table->nwords, word);
+    if (found < 0)
     {
-        sqlite3_finalize(dw->query);
+        return 0;
     }
 
-    sqlite3_close(dw->db);
+    *slot = found;
+    return 1;
 }
 
-int dw_create(struct diceware *dw, const char *db_path, const char *word_path)
+/**
+ * \brief Add the usage counters of \p src to \p dst.
+ */
+static void _dw_merge_stats(struct diceware *dst, const struct diceware *src)
 {
-    char *errmsg;
-    int rc;
+    dst->rng_calls += src->rng_calls;
+    dst->rng_bytes += src->rng_bytes;
+    dst->lookups += src->lookups;
+    dst->sql_steps += src->sql_steps;
+    dst->sql_busy += src->sql_busy;
+    dst->busy_ns += src->busy_ns;
+    dst->bytes_written += src->bytes_written;
+    dst->open_ns += src->open_ns;
+    dst->rng_ns += src->rng_ns;
+    dst->sql_ns += src->sql_ns;
+    dst->write_ns += src->write_ns;
+    dst->generate_ns += src->generate_ns;
+}
 
-    rc = dw_open(dw, db_path);
-    if (rc < 0)
-    {
-        return rc;
-    }
+/**
+ * \brief Close the list held by \p entry, adding its counters to \p base.
+ */
+static void _dw_cache_evict(struct diceware *base,
+        struct dw_cache_entry *entry)
+{
+    _dw_merge_stats(base, &entry->dw);
+    dw_close(&entry->dw);
+    free(entry->list);
+    entry->list = NULL;
+}
 
-    /* Start a new transaction that adds all tables and entries at once. These
-     * must be atomic since the generator expects exactly 6^5 entries.
-     */
-    rc = sqlite3_exec(dw->db, BEGIN_TRANSACTION, NULL, NULL, &errmsg);
-    if (rc != SQLITE_OK)
+/**
+ * \brief Set up a cache of up to \p size named word lists.
+ *
+ * \param cache Cache to initialize.
+ * \param base Open handle used for the default list. It stays owned by the
+ * caller, and the counters of lists closed by the cache are added to it.
+ * \param path Database from which other lists are opened, or \c NULL if
+ * \p base did not come from a database.
+ * \param opts Options \p base was opened with, also used for the other lists,
+ * or \c NULL for the defaults.
+ * \param size Largest number of other lists to keep open.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dw_cache_init(struct dw_cache *cache, struct diceware *base,
+        const char *path, const struct dw_options *opts, size_t size)
+{
+    cache->entries = calloc(size > 0 ? size : 1, sizeof(*cache->entries));
+    if (cache->entries == NULL)
     {
-        warnx("sqlite3_exec(%s): %s", BEGIN_TRANSACTION, errmsg);
-        sqlite3_free(errmsg);
+        warn("calloc");
         return -1;
     }
 
-    rc = sqlite3_exec(dw->db, CREATE_TABLES, NULL, NULL, &errmsg);
-    if (rc != SQLITE_OK)
+    memset(&cache->opts, 0, sizeof(cache->opts));
+    if (opts != NULL)
     {
-        warnx("sqlite3_exec(%s): %s", CREATE_TABLES, errmsg);
-        sqlite3_free(errmsg);
-        dw_close(dw);
-        return -1;
+        cache->opts = *opts;
     }
+    cache->base = base;
+    cache->base_list = cache->opts.list;
+    cache->path = path;
+    cache->size = size;
+    cache->clock = 0;
 
-    rc = _dw_populate(dw, word_path);
-    if (rc < 0)
-    {
-        /* Rollback the transaction; we don't want an incomplete database. */
-        do
-        {
-            rc = sqlite3_exec(dw->db, UNDO_TRANSACTION, NULL, NULL, &errmsg);
-        } while (rc == SQLITE_BUSY);
+    return 0;
+}
 
-        /* Rollback failed; something has gone horribly wrong. */
-        if (rc != SQLITE_OK)
-        {
-            warnx("sqlite3_exec(%s): %s", UNDO_TRANSACTION, errmsg);
-            sqlite3_free(errmsg);
-            return -1;
-        }
+/**
+ * \brief Find the handle for the word list named \p list, opening it if it is
+ * not already open.
+ *
+ * \param cache Cache to look in.
+ * \param list Name of the word list, or \c NULL for the default list.
+ *
+ * \return Returns the handle, which stays valid until the next call, or
+ * \c NULL if the list cannot be opened, after printing an error message to
+ * stderr.
+ */
+struct diceware *dw_cache_get(struct dw_cache *cache, const char *list)
+{
+    struct dw_cache_entry *entry, *victim;
+    struct dw_options opts;
+    char *name;
+    size_t i;
 
-        dw_close(dw);
-        return -1;
+    cache->clock++;
+    if (list == NULL || (cache->base_list != NULL
+                && strcmp(list, cache->base_list) == 0))
+    {
+        return cache->base;
     }
-    /* Finished all diceware entries; commit to the database. */
-    else
+
+    /* Reuse the list if it is open; otherwise replace an unused entry, or the
+     * one used longest ago.
+     */
+    victim = NULL;
+    for (i = 0; i < cache->size; i++)
     {
-        /* Attempt to commit the transaction. */
-        do
+        entry = &cache->entries[i];
+        if (entry->list == NULL)
         {
-            rc = sqlite3_exec(dw->db, END_TRANSACTION, NULL, NULL, &errmsg);
-        } while (rc == SQLITE_BUSY);
-
-        /* Commit to DB failed; return the error and let the higher layer handle
-         * it. */
-        if (rc != SQLITE_OK)
+            victim = entry;
+        }
+        else if (strcmp(entry->list, list) == 0)
         {
-            warnx("sqlite3_exec(%s): %s", END_TRANSACTION, errmsg);
-            sqlite3_free(errmsg);
-
-            dw_close(dw);
-            return -1;
+            entry->used = cache->clock;
+            return &entry->dw;
+        }
+        else if (victim == NULL
+                || (victim->list != NULL && entry->used < victim->used))
+        {
+            victim = entry;
         }
     }
 
-    return 0;
-}
+    if (cache->path == NULL || victim == NULL)
+    {
+        warnx("no database to open word list %s from", list);
+        return NULL;
+    }
 
-int dw_open(struct diceware *dw, const char *path)
-{
-    int rc;
-    sqlite3 *db;
+    if (victim->list != NULL)
+    {
+        _dw_cache_evict(cache->base, victim);
+    }
 
-    rc = sqlite3_open(path, &db);
-    if (rc != SQLITE_OK)
+    name = strdup(list);
+    if (name == NULL)
     {
-        warnx("sqlite3_open(%s): %s", path, sqlite3_errmsg(db));
-        return -1;
+        warn("strdup");
+        return NULL;
     }
 
-    dw->db = db;
-    dw->insert = NULL;
-    dw->query = NULL;
+    opts = cache->opts;
+    opts.list = name;
+    if (dw_open_v2(&victim->dw, cache->path, &opts) < 0)
+    {
+        free(name);
+        return NULL;
+    }
 
-    return 0;
+    victim->list = name;
+    victim->used = cache->clock;
+    return &victim->dw;
 }
 
 /**
- * \brief Generate a diceware passphrase.
- *
- * Using the diceware database \p dw, generate a passphrase using \p nwords
- * words, printing the result top output. If any errors occurs, returns -1.
- * Else, returns 0. Note that the underlying RNG is the cryptographically-secure
- * BSD \c arc4random_uniform function.
- *
- * \param dw Diceware database to use for words.
- * \param output File stream to which the result is written.
- * \param nwords Number of words to use for the passphrase.
+ * \brief Close every list opened by \p cache and free it.
  *
- * \return Returns 0 on successful generation. On failure, prints an error
- * message to stderr and returns -1.
+ * The handle for the default list is left open.
  */
-int dw_generate(struct diceware *dw, FILE *output, size_t nwords)
+void dw_cache_free(struct dw_cache *cache)
 {
-    size_t i, j;
-    uint32_t n;
-    char word[32];
-    int rc;
+    size_t i;
 
-    /* Generate each word separately. */
-    for (i = 0; i < nwords; i++)
+    for (i = 0; i < cache->size; i++)
     {
-        /* Generate the dice rolls needed for selecting a single word; store the
-         * dice rolls in a base-10 number, with each decimal digit representing
-         * a single die.
-         */
-        n = 0;
-        for (j = 0; j < NDICE; j++)
+        if (cache->entries[i].list != NULL)
         {
-            n *= 10;
-            n += arc4random_uniform(MAX_DIE_ROLL) + 1;
+            _dw_cache_evict(cache->base, &cache->entries[i]);
         }
-
-        /* Get the random word and print it to the given stream. */
-        rc = _dw_get_word(dw, n, word, sizeof(word));
-        if (rc != 0)
-        {
-            return -1;
-        }
-
-        rc = fprintf(output, "%s ", word);
-        if (rc < 0)
-        {
-            warn("fprintf");
-            return -1;
-        }
-    }
-
-    rc = fprintf(output, "\n");
-    if (rc < 0)
-    {
-        warn("fprintf");
-        return -1;
     }
 
-    return 0;
+    free(cache->entries);
 }
-
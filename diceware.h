@@ -6,11 +6,78 @@
 #define _DICEWARE_H_
 
 
+#include <stdint.h>
+#include <stdio.h>
+
 #include <sqlite3.h>
 
 #define DICEWARE_VSN_MAJOR 0
 #define DICEWARE_VSN_MINOR 2
 
+struct dw_rng;
+struct dw_chars;
+struct dw_seen;
+struct denylist;
+
+/**
+ * Keep the word list in the database instead of loading it into memory, so
+ * every word is looked up with a query.
+ */
+#define DW_OPEN_NOTABLE 0x1
+
+/**
+ * Promise that the database will not change while it is open, so SQLite can
+ * skip locking it entirely. Databases whose files are not writable at all are
+ * treated this way automatically.
+ */
+#define DW_OPEN_IMMUTABLE 0x2
+
+/**
+ * Default time to wait for a database locked by another process, in
+ * milliseconds.
+ */
+#define DW_BUSY_TIMEOUT 5000
+
+/**
+ * Longest word accepted in a word list, in bytes.
+ */
+#define DW_WORD_MAX 63
+
+/**
+ * Options for #dw_open_v2() and #dw_create_v2().
+ */
+struct dw_options
+{
+    unsigned flags;         /**< Bitwise OR of \c DW_OPEN_* flags. */
+    unsigned busy_timeout;  /**< How long to wait for a locked database, in
+                                 milliseconds, or 0 for #DW_BUSY_TIMEOUT. */
+    const char *list;       /**< Name of the word list within the database,
+                                 or \c NULL for the default list. */
+};
+
+/**
+ * Output formats for #dw_set_format().
+ */
+enum dw_format
+{
+    DW_FORMAT_TEXT,         /**< Words followed by spaces, then a newline. */
+    DW_FORMAT_JSONL,        /**< A JSON object of words and entropy per
+                                 line. */
+    DW_FORMAT_NUL,          /**< Words separated by spaces, then a NUL. */
+    DW_FORMAT_INDICES,      /**< Little-endian slots of the words. */
+};
+
+/**
+ * Limits on generated passphrases, for #dw_set_limits(). Zero means no limit.
+ */
+struct dw_limits
+{
+    unsigned min_word_len;  /**< Shortest word allowed, in characters. */
+    unsigned max_word_len;  /**< Longest word allowed, in characters. */
+    unsigned max_chars;     /**< Longest passphrase allowed, in characters
+                                 including the spaces between words. */
+};
+
 /**
  * Handle for the diceware word database.
  */
@@ -19,12 +86,157 @@ struct diceware
     sqlite3 *db;            /**< Active connection to the database file. */
     sqlite3_stmt *insert;   /**< Statement for inserting words. */
     sqlite3_stmt *query;    /**< Statement for retrieving words. */
+    sqlite3_stmt *lookup;   /**< Statement for retrieving many words at once. */
+    sqlite3_stmt *reverse;  /**< Statement for finding the slot of a word. */
+    char *table;            /**< Table holding the word list. */
+    const char *words;      /**< In-memory word table, or \c NULL. */
+    const uint32_t *offsets;/**< Offset of each word in #words, by slot. */
+    const uint32_t *index;  /**< Slots sorted by their words, for reverse
+                                 lookups in #words. */
+    uint32_t *index_buf;    /**< #index, if it was built in memory. */
+    uint32_t nwords;        /**< Number of words in the list. */
+    unsigned ndice;         /**< Number of dice indexing the list, or 0 if
+                                 words are indexed by position. */
+    uint32_t *by_len;       /**< Slots sorted by the length of their words. */
+    uint32_t *len_start;    /**< Start of each word length in #by_len. */
+    const uint32_t *subset; /**< Slots of the words allowed by the length
+                                 limits, or \c NULL for all of them. */
+    uint32_t nsubset;       /**< Number of words allowed. */
+    unsigned min_len;       /**< Shortest word allowed. */
+    unsigned max_len;       /**< Longest word allowed. */
+    unsigned max_chars;     /**< Longest passphrase allowed, or 0. */
+    struct dw_chars *chars; /**< Counts of passphrases fitting #max_chars. */
+    double entropy;         /**< Bits per passphrase of #entropy_nwords words
+                                 under the current limits, or -1. */
+    size_t entropy_nwords;  /**< Number of words #entropy is for. */
+    struct dw_seen *seen;   /**< Passphrases generated so far, if they must
+                                 be unique. */
+    uint64_t collisions;    /**< Passphrases drawn again because they were
+                                 already generated. */
+    struct denylist *deny;  /**< Hashes of passphrases never to generate. */
+    uint64_t rejections;    /**< Passphrases drawn again because they were
+                                 in #deny. */
+    enum dw_format format;  /**< How passphrases are written out. */
+    char jsonl_end[32];     /**< End of each #DW_FORMAT_JSONL record, with
+                                 the entropy of the passphrases. */
+    void *map;              /**< Mapping backing the word table if it was
+                                 opened from a compact word list. */
+    size_t maplen;          /**< Length of #map. */
+    int builtin;            /**< The word table is compiled into the program. */
+    uint64_t parse_ns;      /**< Time #dw_create() spent parsing the list. */
+    uint64_t insert_ns;     /**< Time #dw_create() spent storing the list. */
+    struct dw_rng *rng;     /**< Pool of random words for generation. */
+    uint64_t rng_calls;     /**< Number of calls made to the system RNG. */
+    uint64_t rng_bytes;     /**< Number of random bytes fetched. */
+    uint64_t lookups;       /**< Number of words looked up. */
+    uint64_t sql_steps;     /**< Number of SQLite statement steps. */
+    uint64_t sql_busy;      /**< Number of retries after \c SQLITE_BUSY. */
+    unsigned busy_timeout;  /**< How long to wait for a locked database, in
+                                 milliseconds. */
+    uint64_t busy_start;    /**< When the current wait for a lock began. */
+    uint64_t busy_ns;       /**< Time spent waiting for locked databases. */
+    uint64_t bytes_written; /**< Number of bytes of passphrases written. */
+    uint64_t open_ns;       /**< Time spent opening the word list. */
+    uint64_t rng_ns;        /**< Time spent fetching random bytes. */
+    uint64_t sql_ns;        /**< Time spent stepping SQLite statements. */
+    uint64_t write_ns;      /**< Time spent writing passphrases out. */
+    uint64_t generate_ns;   /**< Total time spent generating passphrases. */
+};
+
+/**
+ * Word list held open by a #dw_cache.
+ */
+struct dw_cache_entry
+{
+    char *list;             /**< Name of the list, or \c NULL if unused. */
+    struct diceware dw;     /**< Open handle for the list. */
+    uint64_t used;          /**< Value of #dw_cache.clock when last used. */
+};
+
+/**
+ * In-memory word table that never changes once opened, so any number of
+ * threads can share it. See #dw_table_open().
+ */
+struct dw_table
+{
+    const char *words;      /**< Packed, NUL-terminated words in slot order. */
+    const uint32_t *offsets;/**< Offset of each word in #words, by slot. */
+    const uint32_t *index;  /**< Slots sorted by their words. */
+    uint32_t *index_buf;    /**< #index, if it was built in memory. */
+    uint32_t nwords;        /**< Number of words in the list. */
+    unsigned ndice;         /**< Number of dice indexing the list, or 0 if
+                                 words are indexed by position. */
+    void *map;              /**< Mapping backing the table, or \c NULL. */
+    size_t maplen;          /**< Length of #map. */
+    int builtin;            /**< The table is compiled into the program. */
+};
+
+/**
+ * Per-thread context for generating passphrases from a shared #dw_table.
+ */
+struct dw_gen
+{
+    const struct dw_table *table;   /**< Table the words come from. */
+    struct dw_rng *rng;     /**< Private pool of random words. */
+};
+
+/**
+ * Cache of word lists opened from one database, which closes the least
+ * recently used list when it is full.
+ */
+struct dw_cache
+{
+    struct diceware *base;  /**< Handle for the default list; never evicted. */
+    const char *base_list;  /**< Name of the list in #base, or \c NULL. */
+    const char *path;       /**< Database holding the other lists, or \c NULL
+                                 if there is none. */
+    struct dw_options opts; /**< Options for opening the other lists. */
+    struct dw_cache_entry *entries; /**< Open lists. */
+    size_t size;            /**< Number of entries in #entries. */
+    uint64_t clock;         /**< Incremented on every lookup. */
 };
 
 int dw_open(struct diceware *dw, const char *path);
+int dw_open_v2(struct diceware *dw, const char *path,
+        const struct dw_options *opts);
+int dw_open_builtin(struct diceware *dw);
 void dw_close(struct diceware *dw);
 int dw_create(struct diceware *dw, const char *db_path, const char *word_path);
+int dw_create_v2(struct diceware *dw, const char *db_path,
+        const char *word_path, const struct dw_options *opts);
+int dw_export(struct diceware *dw, const char *path);
+int dw_sample(struct diceware *dw, uint32_t *slots, size_t n);
+int dw_set_limits(struct diceware *dw, const struct dw_limits *limits);
+double dw_entropy(struct diceware *dw, size_t nwords);
+int dw_words_for_bits(struct diceware *dw, double bits, size_t *nwords);
+int dw_set_unique(struct diceware *dw, size_t nwords, size_t count);
+int dw_set_denylist(struct diceware *dw, const char *path);
+int dw_set_format(struct diceware *dw, enum dw_format format);
+const char *dw_word(struct diceware *dw, uint32_t slot, char *buf, size_t len);
+int dw_lookup_word(struct diceware *dw, const char *word, uint32_t *slot);
+int dw_decode(struct diceware *dw, FILE *input, FILE *output);
+int dw_encode_bytes(struct diceware *dw, FILE *input, FILE *output);
+int dw_decode_bytes(struct diceware *dw, FILE *input, FILE *output);
 int dw_generate(struct diceware *dw, FILE *output, size_t nwords);
+int dw_generate_batch(struct diceware *dw, FILE *output, size_t nwords,
+        size_t count);
+int dw_generate_mem(struct diceware *dw, char *buf, size_t cap, size_t *len,
+        size_t nwords, size_t count);
+int dw_generate_parallel(struct diceware *dw, FILE *output, size_t nwords,
+        size_t count, unsigned nthreads);
+int dw_table_open(struct dw_table *table, const char *path,
+        const struct dw_options *opts);
+int dw_table_open_builtin(struct dw_table *table);
+void dw_table_close(struct dw_table *table);
+int dw_table_lookup(const struct dw_table *table, const char *word,
+        uint32_t *slot);
+int dw_gen_init(struct dw_gen *ctx, const struct dw_table *table);
+void dw_gen_free(struct dw_gen *ctx);
+int dw_generate_buf(struct dw_gen *ctx, char *out, size_t cap, size_t nwords);
+int dw_cache_init(struct dw_cache *cache, struct diceware *base,
+        const char *path, const struct dw_options *opts, size_t size);
+struct diceware *dw_cache_get(struct dw_cache *cache, const char *list);
+void dw_cache_free(struct dw_cache *cache);
 
 
 #endif /* end of include guard: _DICEWARE_H_ */
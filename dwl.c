@@ -0,0 +1,289 @@
+/**
+ * \file dwl.c
+ *
+ * \brief Compact, memory-mappable word list files.
+ *
+ * A compact word list (conventionally named <tt>*.dwl</tt>) holds the same
+ * words as a diceware database, laid out exactly as the in-memory word table:
+ * a #dwl_header, an array of <tt>nwords + 1</tt> 32-bit offsets, the slots
+ * sorted by word for reverse lookups, and a blob of NUL-terminated words in
+ * slot order. Opening one is a single \c mmap with no
+ * parsing; the file is only checked for consistency so that every word is a
+ * valid string inside the mapping.
+ *
+ * Files are written in the byte order of the host that created them, and are
+ * rejected on hosts with a different byte order.
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "diceware.h"
+#include "dwl.h"
+
+/**
+ * Value of #dwl_header.byteorder as seen by a host with the same byte order.
+ */
+#define DWL_BYTEORDER 0x01020304
+
+/**
+ * Largest number of dice a list may be indexed by.
+ */
+#define DWL_MAX_DICE 8
+
+/**
+ * \brief Check whether \p path names a compact word list, judging by its
+ * <tt>.dwl</tt> extension.
+ */
+int dwl_is_path(const char *path)
+{
+    size_t len;
+
+    len = strlen(path);
+    return len >= 4 && strcmp(path + len - 4, ".dwl") == 0;
+}
+
+/**
+ * \brief Check that the mapped file in \p map is a consistent word list and
+ * fill in the pointers to its tables.
+ */
+static int _dwl_check(const char *path, struct dwl_map *map)
+{
+    const struct dwl_header *hdr = map->base;
+    const char *words;
+    const uint32_t *offsets, *index;
+    size_t size;
+    uint32_t i, nrolls;
+
+    if (hdr->byteorder != DWL_BYTEORDER)
+    {
+        warnx("%s: word list has the wrong byte order", path);
+        return -1;
+    }
+
+    if (hdr->version != DWL_VERSION)
+    {
+        warnx("%s: unsupported word list version %u", path, hdr->version);
+        return -1;
+    }
+
+    /* The offsets, index and blob must exactly fill the rest of the file. */
+    size = sizeof(*hdr) + (2 * (size_t)hdr->nwords + 1) * sizeof(*offsets)
+        + hdr->blobsize;
+    if (hdr->nwords < 2 || size != map->len)
+    {
+        warnx("%s: truncated word list", path);
+        return -1;
+    }
+
+    /* Lists indexed by dice must have a word for every roll. */
+    nrolls = 1;
+    for (i = 0; i < hdr->ndice && i < DWL_MAX_DICE; i++)
+    {
+        nrolls *= 6;
+    }
+    if (hdr->ndice > DWL_MAX_DICE
+            || (hdr->ndice > 0 && hdr->nwords != nrolls))
+    {
+        warnx("%s: incomplete word list", path);
+        return -1;
+    }
+
+    offsets = (const uint32_t *)(hdr + 1);
+    index = offsets + hdr->nwords + 1;
+    words = (const char *)(index + hdr->nwords);
+
+    /* Every word must be a non-empty string of at most #DW_WORD_MAX bytes,
+     * as in any other list, ending in a NUL inside the blob. The offsets are
+     * compared as 64-bit numbers so that none can wrap around. */
+    if (offsets[0] != 0 || offsets[hdr->nwords] != hdr->blobsize)
+    {
+        warnx("%s: corrupt word list", path);
+        return -1;
+    }
+    for (i = 0; i < hdr->nwords; i++)
+    {
+        if ((uint64_t)offsets[i + 1] <= (uint64_t)offsets[i] + 1
+                || offsets[i + 1] > hdr->blobsize
+                || offsets[i + 1] - offsets[i] - 1 > DW_WORD_MAX
+                || words[offsets[i + 1] - 1] != '\0'
+                || memchr(words + offsets[i], '\0',
+                    offsets[i + 1] - offsets[i] - 1) != NULL)
+        {
+            warnx("%s: corrupt word list", path);
+            return -1;
+        }
+    }
+
+    /* Lookups trust the index to point at words, if not to be sorted. */
+    for (i = 0; i < hdr->nwords; i++)
+    {
+        if (index[i] >= hdr->nwords)
+        {
+            warnx("%s: corrupt word list", path);
+            return -1;
+        }
+    }
+
+    map->words = words;
+    map->index = index;
+    map->offsets = offsets;
+    map->nwords = hdr->nwords;
+    map->ndice = hdr->ndice;
+
+    return 0;
+}
+
+/**
+ * \brief Map the compact word list at \p path into memory.
+ *
+ * \param path Path to the file to map.
+ * \param map Filled in with the mapping on success.
+ *
+ * \return Returns 1 if the file was mapped, or 0 if it is not a compact word
+ * list (including if it cannot be opened), in which case \p map is unchanged.
+ * If the file is a compact word list but is corrupt, prints an error message
+ * to stderr and returns -1.
+ */
+int dwl_map(const char *path, struct dwl_map *map)
+{
+    struct stat st;
+    void *base;
+    int fd, rc;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct dwl_header))
+    {
+        close(fd);
+        return 0;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        warn("mmap(%s)", path);
+        return -1;
+    }
+
+    if (memcmp(base, DWL_MAGIC, sizeof(DWL_MAGIC)) != 0)
+    {
+        munmap(base, st.st_size);
+        return 0;
+    }
+
+    map->base = base;
+    map->len = st.st_size;
+    rc = _dwl_check(path, map);
+    if (rc < 0)
+    {
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    return 1;
+}
+
+/**
+ * \brief Write a compact word list to \p path.
+ *
+ * The list is written to a temporary file next to \p path and renamed over
+ * it once it is safely on disk, so processes that have the old file mapped
+ * keep reading it undisturbed.
+ *
+ * \param path Path of the file to create or replace.
+ * \param words Packed, NUL-terminated words in slot order.
+ * \param offsets Offset of each word in \p words, plus one final entry giving
+ * the total size of \p words.
+ * \param index Slots of the words, sorted by word.
+ * \param nwords Number of words.
+ * \param ndice Number of dice indexing the list, or 0 if words are indexed by
+ * position.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int dwl_write(const char *path, const char *words, const uint32_t *offsets,
+        const uint32_t *index, uint32_t nwords, uint32_t ndice)
+{
+    struct dwl_header hdr;
+    char tmp[4096];
+    FILE *output;
+    int fd, rc;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, DWL_MAGIC, sizeof(DWL_MAGIC));
+    hdr.byteorder = DWL_BYTEORDER;
+    hdr.version = DWL_VERSION;
+    hdr.nwords = nwords;
+    hdr.blobsize = offsets[nwords];
+    hdr.ndice = ndice;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+    {
+        warnx("path too long: %s", path);
+        return -1;
+    }
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        warn("open(%s)", tmp);
+        return -1;
+    }
+
+    output = fdopen(fd, "wb");
+    if (output == NULL)
+    {
+        warn("fdopen(%s)", tmp);
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+
+    rc = 0;
+    if (fwrite(&hdr, sizeof(hdr), 1, output) != 1
+            || fwrite(offsets, sizeof(*offsets), nwords + 1, output)
+                != nwords + 1
+            || fwrite(index, sizeof(*index), nwords, output) != nwords
+            || fwrite(words, 1, hdr.blobsize, output) != hdr.blobsize)
+    {
+        warn("fwrite(%s)", tmp);
+        rc = -1;
+    }
+
+    if (rc == 0 && (fflush(output) != 0 || fsync(fd) < 0))
+    {
+        warn("fsync(%s)", tmp);
+        rc = -1;
+    }
+
+    if (fclose(output) != 0 && rc == 0)
+    {
+        warn("fclose(%s)", tmp);
+        rc = -1;
+    }
+
+    if (rc == 0 && rename(tmp, path) < 0)
+    {
+        warn("rename(%s)", path);
+        rc = -1;
+    }
+
+    if (rc < 0)
+    {
+        unlink(tmp);
+    }
+
+    return rc;
+}
@@ -0,0 +1,58 @@
+/**
+ * \file dwl.h
+ */
+
+#ifndef _DWL_H_
+#define _DWL_H_
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Magic bytes at the start of every compact word list file.
+ */
+#define DWL_MAGIC "DWL"
+
+/**
+ * Version of the compact word list format written by #dwl_write().
+ */
+#define DWL_VERSION 1
+
+/**
+ * Header of a compact word list file. It is followed by <tt>nwords + 1</tt>
+ * offsets into the blob, then \c nwords slots sorted by their words, and then
+ * the blob of NUL-terminated words.
+ */
+struct dwl_header
+{
+    char magic[4];          /**< #DWL_MAGIC, including the NUL. */
+    uint32_t byteorder;     /**< 0x01020304 in the writer's byte order. */
+    uint32_t version;       /**< Format version, #DWL_VERSION. */
+    uint32_t nwords;        /**< Number of words in the list. */
+    uint32_t blobsize;      /**< Size of the word blob in bytes. */
+    uint32_t ndice;         /**< Number of dice indexing the list, or 0 if
+                                 words are indexed by position. */
+};
+
+/**
+ * Compact word list file mapped into memory.
+ */
+struct dwl_map
+{
+    void *base;             /**< Start of the mapping. */
+    size_t len;             /**< Length of the mapping. */
+    const char *words;      /**< Packed words inside the mapping. */
+    const uint32_t *offsets;/**< Offset of each word in #words. */
+    const uint32_t *index;  /**< Slots sorted by word. */
+    uint32_t nwords;        /**< Number of words in the list. */
+    uint32_t ndice;         /**< Number of dice indexing the list, or 0. */
+};
+
+int dwl_is_path(const char *path);
+int dwl_map(const char *path, struct dwl_map *map);
+int dwl_write(const char *path, const char *words, const uint32_t *offsets,
+        const uint32_t *index, uint32_t nwords, uint32_t ndice);
+
+
+#endif /* end of include guard: _DWL_H_ */
@@ -0,0 +1,84 @@
+# Turn a diceware word list into a C source file holding the in-memory word
+# table, so that the list can be compiled into the program.
+#
+# Usage: cmake -DINPUT=<wordlist> -DOUTPUT=<source.c> -P gen_wordlist.cmake
+#
+# The list must contain every roll from 11111 to 66666 exactly once, in order;
+# the words are emitted in that order so that a word's position in the table is
+# its slot. The slots are also emitted sorted by word, for reverse lookups.
+
+file(STRINGS "${INPUT}" lines)
+
+set(words "")
+set(offsets "")
+set(offset 0)
+set(count 0)
+set(previous "")
+set(keyed "")
+
+# Words may hold any printable ASCII character that the runtime parser
+# accepts, except for quotes and backslashes, which would need escaping in the
+# generated source, and semicolons and square brackets, which CMake treats
+# specially in lists.
+set(word_re "[!#-:<-Z^-~]+")
+
+foreach(line IN LISTS lines)
+    if(NOT line MATCHES "^([1-6][1-6][1-6][1-6][1-6])[ \t]+(${word_re})[ \t]*$")
+        message(FATAL_ERROR "${INPUT}: invalid line: ${line}")
+    endif()
+
+    set(roll "${CMAKE_MATCH_1}")
+    set(word "${CMAKE_MATCH_2}")
+    if(NOT roll STRGREATER "${previous}")
+        message(FATAL_ERROR "${INPUT}: rolls out of order at ${roll}")
+    endif()
+    set(previous "${roll}")
+
+    # Escape question marks so that no trigraphs are formed.
+    string(REPLACE "?" "\\?" escaped "${word}")
+    string(APPEND words "    \"${escaped}\\0\"\n")
+    string(APPEND offsets "    ${offset},\n")
+
+    # Blanks sort before any character allowed in a word, so sorting
+    # "<word> <slot>" sorts by word.
+    list(APPEND keyed "${word} ${count}")
+
+    string(LENGTH "${word}" len)
+    math(EXPR offset "${offset} + ${len} + 1")
+    math(EXPR count "${count} + 1")
+endforeach()
+
+if(NOT count EQUAL 7776)
+    message(FATAL_ERROR "${INPUT}: expected 7776 words, found ${count}")
+endif()
+
+list(SORT keyed)
+set(index "")
+set(previous "")
+foreach(entry IN LISTS keyed)
+    string(REGEX MATCH "^([^ ]+) ([0-9]+)$" entry "${entry}")
+    if(CMAKE_MATCH_1 STREQUAL previous)
+        message(FATAL_ERROR "${INPUT}: duplicate word: ${previous}")
+    endif()
+    set(previous "${CMAKE_MATCH_1}")
+    string(APPEND index "    ${CMAKE_MATCH_2},\n")
+endforeach()
+
+get_filename_component(name "${INPUT}" NAME)
+file(WRITE "${OUTPUT}"
+"/* Generated from ${name} by gen_wordlist.cmake; do not edit. */
+
+#include <stdint.h>
+
+const uint32_t dw_builtin_nwords = ${count};
+
+const char dw_builtin_words[] =
+${words};
+
+const uint32_t dw_builtin_offsets[] = {
+${offsets}    ${offset}
+};
+
+const uint32_t dw_builtin_index[] = {
+${index}};
+")
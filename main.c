@@ -8,23 +8,214 @@
 
 #include <err.h>
 #include <getopt.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "diceware.h"
+#include "server.h"
+#include "stats.h"
 
 #define USAGE_STRING \
-	"usage: %s [-d <dbfile>] [-h] [-n <num>] [-v] [-w <wordlist>]\n"
+	"usage: %s [-b <bits>] [--builtin] [--busy-timeout <ms>] " \
+	"[-c <count>] [--client <socket>] [-d <dbfile>] [--decode] " \
+	"[--decode-bytes] [--deny-hashes <file>] [--encode-bytes] " \
+	"[--format text|jsonl|nul|indices] [-h] " \
+	"[--import-stats] [-j <threads>] [-l <list>] [--max-chars <num>] " \
+	"[--max-word-len <num>] [--min-word-len <num>] [-n <num>] [-s] " \
+	"[--serve <socket>] [--stats-file <file>] [--unique] [-v] " \
+	"[-w <wordlist>] [-x <outfile>]\n"
 #define VSN_STRING   "Diceware v%d.%d, Copyright (C) 2017 Brian Kubisiak\n"
 
+/* Options that only have a long form. */
+enum
+{
+    OPT_BUILTIN = 256,
+    OPT_IMPORT_STATS,
+    OPT_SERVE,
+    OPT_CLIENT,
+    OPT_STATS_FILE,
+    OPT_BUSY_TIMEOUT,
+    OPT_DECODE,
+    OPT_ENCODE_BYTES,
+    OPT_DECODE_BYTES,
+    OPT_MIN_WORD_LEN,
+    OPT_MAX_WORD_LEN,
+    OPT_MAX_CHARS,
+    OPT_UNIQUE,
+    OPT_DENY_HASHES,
+    OPT_FORMAT,
+};
+
+static const struct option long_options[] =
+{
+    {"builtin", no_argument, NULL, OPT_BUILTIN},
+    {"import-stats", no_argument, NULL, OPT_IMPORT_STATS},
+    {"serve", required_argument, NULL, OPT_SERVE},
+    {"client", required_argument, NULL, OPT_CLIENT},
+    {"stats", no_argument, NULL, 's'},
+    {"stats-file", required_argument, NULL, OPT_STATS_FILE},
+    {"busy-timeout", required_argument, NULL, OPT_BUSY_TIMEOUT},
+    {"decode", no_argument, NULL, OPT_DECODE},
+    {"encode-bytes", no_argument, NULL, OPT_ENCODE_BYTES},
+    {"decode-bytes", no_argument, NULL, OPT_DECODE_BYTES},
+    {"min-word-len", required_argument, NULL, OPT_MIN_WORD_LEN},
+    {"max-word-len", required_argument, NULL, OPT_MAX_WORD_LEN},
+    {"max-chars", required_argument, NULL, OPT_MAX_CHARS},
+    {"unique", no_argument, NULL, OPT_UNIQUE},
+    {"deny-hashes", required_argument, NULL, OPT_DENY_HASHES},
+    {"format", required_argument, NULL, OPT_FORMAT},
+    {NULL, 0, NULL, 0},
+};
+
+/**
+ * Names of the output formats accepted by \c --format, indexed by
+ * #dw_format.
+ */
+static const char *const format_names[] =
+{
+    [DW_FORMAT_TEXT] = "text",
+    [DW_FORMAT_JSONL] = "jsonl",
+    [DW_FORMAT_NUL] = "nul",
+    [DW_FORMAT_INDICES] = "indices",
+};
+
+/**
+ * \brief Ask the server listening at \p path for \p count passphrases of
+ * \p len words each from the named \p list, or from the server's default
+ * list if \p list is \c NULL, and copy them to \c stdout.
+ *
+ * Batches larger than a single request may ask for are fetched with several
+ * requests, one after the other.
+ */
+static int client(const char *path, const char *list, unsigned long len,
+        unsigned long count)
+{
+    struct sockaddr_un addr;
+    FILE *conn;
+    char *line;
+    size_t cap;
+    unsigned long n, got, batch;
+    int fd, rc;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        warnx("socket path too long: %s", path);
+        return -1;
+    }
+
+    /* The name goes into a request line of blank-separated arguments. */
+    if (list != NULL && (*list == '\0' || strpbrk(list, " \t\r\n") != NULL))
+    {
+        warnx("invalid list name: %s", list);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        warn("socket");
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        warn("connect(%s)", path);
+        close(fd);
+        return -1;
+    }
+
+    conn = fdopen(fd, "r+");
+    if (conn == NULL)
+    {
+        warn("fdopen");
+        close(fd);
+        return -1;
+    }
+
+    /* Let the server reject word counts it does not support. */
+    batch = len > 0 && len <= SERVER_MAX_WORDS
+        ? SERVER_MAX_REQUEST_WORDS / len : count;
+
+    line = NULL;
+    cap = 0;
+    rc = 0;
+    while (count > 0 && rc == 0)
+    {
+        n = count < batch ? count : batch;
+        count -= n;
+
+        if (fprintf(conn, "GEN n=%lu count=%lu%s%s\n", len, n,
+                    list != NULL ? " list=" : "", list != NULL ? list : "") < 0
+                || fflush(conn) != 0)
+        {
+            warn("write(%s)", path);
+            rc = -1;
+        }
+
+        /* The passphrases come in chunks, each behind its own status line. */
+        while (n > 0 && rc == 0)
+        {
+            rc = -1;
+            if (getline(&line, &cap, conn) < 0)
+            {
+                warnx("%s: connection closed", path);
+            }
+            else if (strncmp(line, "OK ", 3) != 0)
+            {
+                line[strcspn(line, "\n")] = '\0';
+                warnx("%s: %s", path, line);
+            }
+            else if ((got = strtoul(line + 3, NULL, 10)) == 0 || got > n)
+            {
+                warnx("%s: unexpected response", path);
+            }
+            else
+            {
+                /* Copy exactly as many lines as the server announced. */
+                for (n -= got, rc = 0; got > 0 && rc == 0; got--)
+                {
+                    if (getline(&line, &cap, conn) < 0)
+                    {
+                        warnx("%s: connection closed", path);
+                        rc = -1;
+                    }
+                    else if (fputs(line, stdout) == EOF)
+                    {
+                        warn("fputs");
+                        rc = -1;
+                    }
+                }
+            }
+        }
+    }
+
+    free(line);
+    fclose(conn);
+    return rc;
+}
+
 int main(int argc, char *argv[])
 {
     struct diceware dw;
-    int arg, rc;
-    unsigned long len;
-    char *db_file, *word_file;
+    struct dw_options opts;
+    struct dw_limits limits;
+    struct dw_cache cache;
+    int arg, rc, stats, builtin, import_stats, decode, encode_bytes;
+    int decode_bytes, unique, format;
+    unsigned long len, count, threads;
+    size_t nwords;
+    double bits, entropy;
+    char *db_file, *word_file, *export_file, *serve_path, *client_path;
+    char *stats_file, *deny_file;
     char *endptr;
     char default_path[128];
     char *home;
@@ -41,15 +232,144 @@ int main(int argc, char *argv[])
 
     /* Set defaults */
     len = 4ul;
+    bits = 0.0;
+    count = 1ul;
+    threads = 1ul;
+    stats = 0;
+    builtin = 0;
+    import_stats = 0;
+    decode = 0;
+    encode_bytes = 0;
+    decode_bytes = 0;
+    unique = 0;
+    format = DW_FORMAT_TEXT;
     db_file = default_path;
     word_file = NULL;
+    export_file = NULL;
+    serve_path = NULL;
+    client_path = NULL;
+    stats_file = NULL;
+    deny_file = NULL;
+    memset(&opts, 0, sizeof(opts));
+    memset(&limits, 0, sizeof(limits));
 
     /* Turn off automatic logging; we will print errors on our own. */
     opterr = 0;
-    while ((arg = getopt(argc, argv, "d:hn:vw:")) != -1)
+    while ((arg = getopt_long(argc, argv, "b:c:d:hj:l:n:svw:x:", long_options,
+                    NULL)) != -1)
     {
         switch (arg)
         {
+        /* Use the word list compiled into the program instead of a database. */
+        case OPT_BUILTIN:
+            builtin = 1;
+            break;
+        /* Report how long importing the word list took. */
+        case OPT_IMPORT_STATS:
+            import_stats = 1;
+            break;
+        /* Run as a daemon answering requests on a Unix socket. */
+        case OPT_SERVE:
+            serve_path = optarg;
+            break;
+        /* Fetch passphrases from a running daemon. */
+        case OPT_CLIENT:
+            client_path = optarg;
+            break;
+        /* Export the counters as a Prometheus text file when done. */
+        case OPT_STATS_FILE:
+            stats_file = optarg;
+            break;
+        /* Set how long to wait for a database locked by another process. */
+        case OPT_BUSY_TIMEOUT:
+            opts.busy_timeout = strtoul(optarg, &endptr, 10);
+            if (*endptr != '\0' || opts.busy_timeout == 0)
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        /* Turn passphrases read from stdin back into dice rolls. */
+        case OPT_DECODE:
+            decode = 1;
+            break;
+        /* Encode bytes read from stdin as words. */
+        case OPT_ENCODE_BYTES:
+            encode_bytes = 1;
+            break;
+        /* Decode words read from stdin back into bytes. */
+        case OPT_DECODE_BYTES:
+            decode_bytes = 1;
+            break;
+        /* Only use words of at least this many characters. */
+        case OPT_MIN_WORD_LEN:
+            limits.min_word_len = strtoul(optarg, &endptr, 10);
+            if (*endptr != '\0')
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        /* Only use words of at most this many characters. */
+        case OPT_MAX_WORD_LEN:
+            limits.max_word_len = strtoul(optarg, &endptr, 10);
+            if (*endptr != '\0')
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        /* Only generate passphrases of at most this many characters. */
+        case OPT_MAX_CHARS:
+            limits.max_chars = strtoul(optarg, &endptr, 10);
+            if (*endptr != '\0')
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        /* Use as few words as give passphrases this many bits of entropy. */
+        case 'b':
+            bits = strtod(optarg, &endptr);
+            if (*endptr != '\0' || !(bits > 0) || !isfinite(bits))
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        /* Never generate the same passphrase twice in one run. */
+        case OPT_UNIQUE:
+            unique = 1;
+            break;
+        /* Never generate passphrases whose SHA-1 hash is in this file. */
+        case OPT_DENY_HASHES:
+            deny_file = optarg;
+            break;
+        /* Choose how passphrases are written out. */
+        case OPT_FORMAT:
+            for (format = 0; format < (int)(sizeof(format_names)
+                        / sizeof(format_names[0])); format++)
+            {
+                if (strcmp(optarg, format_names[format]) == 0)
+                {
+                    break;
+                }
+            }
+            if (format == (int)(sizeof(format_names) / sizeof(format_names[0])))
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        /* Set the number of passphrases to generate. */
+        case 'c':
+            count = strtoul(optarg, &endptr, 10);
+            if (*endptr != '\0')
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
         /* Set the path to the database file */
         case 'd':
             db_file = optarg;
@@ -59,6 +379,19 @@ int main(int argc, char *argv[])
 	    fprintf(stderr, USAGE_STRING, argv[0]);
 	    exit(EXIT_SUCCESS);
 	    break;
+        /* Set the number of threads generating passphrases. */
+        case 'j':
+            threads = strtoul(optarg, &endptr, 10);
+            if (*endptr != '\0' || threads == 0)
+            {
+                fprintf(stderr, USAGE_STRING, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        /* Select a named word list within the database. */
+        case 'l':
+            opts.list = optarg;
+            break;
         /* Set the number of words to use in the passphrase. */
         case 'n':
             len = strtoul(optarg, &endptr, 10);
@@ -68,6 +401,10 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
             }
             break;
+        /* Report counters and timers on stderr when done. */
+        case 's':
+            stats = 1;
+            break;
         /* Print version info and exit. */
         case 'v':
 	    fprintf(stderr, VSN_STRING, DICEWARE_VSN_MAJOR, DICEWARE_VSN_MINOR);
@@ -77,6 +414,10 @@ int main(int argc, char *argv[])
         case 'w':
             word_file = optarg;
             break;
+        /* Convert the word list to another database or compact list. */
+        case 'x':
+            export_file = optarg;
+            break;
         default:
             fprintf(stderr, USAGE_STRING, argv[0]);
 	    exit(EXIT_FAILURE);
@@ -84,16 +425,45 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (builtin && (word_file != NULL || opts.list != NULL))
+    {
+        fprintf(stderr, USAGE_STRING, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* The server generates plain passphrases from whole lists, and the client
+     * only copies what it sends.
+     */
+    if ((client_path != NULL || serve_path != NULL)
+            && (format != DW_FORMAT_TEXT || unique || deny_file != NULL
+                || bits > 0 || limits.min_word_len > 0
+                || limits.max_word_len > 0 || limits.max_chars > 0))
+    {
+        fprintf(stderr, USAGE_STRING, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* The client needs no word list of its own. */
+    if (client_path != NULL)
+    {
+        rc = client(client_path, opts.list, len, count);
+        return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
     /* Create a new database if a word list was specified; otherwise, open a
      * connection to an existing database.
      */
-    if (word_file == NULL)
+    if (builtin)
+    {
+        rc = dw_open_builtin(&dw);
+    }
+    else if (word_file == NULL)
     {
-        rc = dw_open(&dw, db_file);
+        rc = dw_open_v2(&dw, db_file, &opts);
     }
     else
     {
-        rc = dw_create(&dw, db_file, word_file);
+        rc = dw_create_v2(&dw, db_file, word_file, &opts);
     }
 
     if (rc < 0)
@@ -102,16 +472,127 @@ int main(int argc, char *argv[])
         goto main_exit;
     }
 
-    rc = dw_generate(&dw, stdout, len);
-    if (rc < 0)
+    if (import_stats && word_file != NULL)
+    {
+        fprintf(stderr, "import: parse %.3f ms, insert %.3f ms\n",
+                dw.parse_ns / 1e6, dw.insert_ns / 1e6);
+    }
+
+    /* When converting, write the list out instead of generating anything. */
+    if (export_file != NULL)
+    {
+        rc = dw_export(&dw, export_file);
+        if (rc < 0)
+        {
+            rc = EXIT_FAILURE;
+        }
+        goto main_cleanup;
+    }
+
+    if (decode || encode_bytes || decode_bytes)
+    {
+        if (encode_bytes)
+        {
+            rc = dw_encode_bytes(&dw, stdin, stdout);
+        }
+        else if (decode_bytes)
+        {
+            rc = dw_decode_bytes(&dw, stdin, stdout);
+        }
+        else
+        {
+            rc = dw_decode(&dw, stdin, stdout);
+        }
+        if (rc < 0)
+        {
+            rc = EXIT_FAILURE;
+        }
+        goto main_cleanup;
+    }
+
+    if (serve_path != NULL)
+    {
+        rc = dw_cache_init(&cache, &dw, builtin ? NULL : db_file, &opts,
+                SERVER_MAX_LISTS);
+        if (rc == 0)
+        {
+            rc = server_run(&cache, serve_path);
+            dw_cache_free(&cache);
+        }
+        if (rc < 0)
+        {
+            rc = EXIT_FAILURE;
+        }
+        goto main_cleanup;
+    }
+
+    if ((limits.min_word_len > 0 || limits.max_word_len > 0
+                || limits.max_chars > 0) && dw_set_limits(&dw, &limits) < 0)
     {
         rc = EXIT_FAILURE;
         goto main_cleanup;
     }
 
+    if (bits > 0)
+    {
+        if (dw_words_for_bits(&dw, bits, &nwords) < 0)
+        {
+            rc = EXIT_FAILURE;
+            goto main_cleanup;
+        }
+        len = nwords;
+    }
+
+    /* When the number of passphrases is not simply the list size to the
+     * power of the number of words, say how strong they are.
+     */
+    if (bits > 0 || limits.min_word_len > 0 || limits.max_word_len > 0
+            || limits.max_chars > 0)
+    {
+        entropy = dw_entropy(&dw, len);
+        if (entropy < 0)
+        {
+            rc = EXIT_FAILURE;
+            goto main_cleanup;
+        }
+        fprintf(stderr, "entropy: %.2f bits per passphrase of %lu words\n",
+                entropy, len);
+    }
+
+    /* Every entropy figure counts passphrases the deny list may remove. */
+    if (deny_file != NULL && (bits > 0 || limits.min_word_len > 0
+                || limits.max_word_len > 0 || limits.max_chars > 0 || stats
+                || stats_file != NULL || format == DW_FORMAT_JSONL))
+    {
+        warnx("entropy ignores the deny list, so it is only an upper bound");
+    }
+
+    if ((unique && dw_set_unique(&dw, len, count) < 0)
+            || (deny_file != NULL && dw_set_denylist(&dw, deny_file) < 0)
+            || dw_set_format(&dw, format) < 0)
+    {
+        rc = EXIT_FAILURE;
+        goto main_cleanup;
+    }
+
+    rc = dw_generate_parallel(&dw, stdout, len, count, threads);
+    if (rc < 0)
+    {
+        rc = EXIT_FAILURE;
+    }
+
 main_cleanup:
+    if (stats && stats_print(&dw, stderr) < 0)
+    {
+        rc = EXIT_FAILURE;
+    }
+    if (stats_file != NULL && stats_write_prometheus(&dw, stats_file) < 0)
+    {
+        rc = EXIT_FAILURE;
+    }
+
     dw_close(&dw);
 main_exit:
-    return EXIT_SUCCESS;
+    return rc;
 }
 
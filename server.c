@@ -0,0 +1,658 @@
+/**
+ * \file server.c
+ *
+ * \brief Serve passphrases to local clients over a Unix domain socket.
+ *
+ * The server keeps its word lists open, so the word tables stay in memory
+ * between requests, and multiplexes any number of clients with
+ * \c epoll. Each client sends requests one per line:
+ *
+ * GEN n=6 count=100 list=short
+ *
+ * All arguments are optional and default to 4 words, 1 passphrase and the
+ * list the server was started with. Other lists are loaded from the same
+ * database on first use, and the most recently used ones are kept in memory.
+ * The server answers each request in order with one or more <tt>OK n</tt>
+ * lines, each followed by \c n passphrases, one per line, until it has sent
+ * \c count in all. If a request is invalid, or passphrases cannot be
+ * generated, the server answers with <tt>ERR message</tt> in place of the
+ * next <tt>OK n</tt> line and moves on to the next request. A request may ask
+ * for at most #SERVER_MAX_REQUEST_WORDS words in all, so larger batches take
+ * several.
+ *
+ * Passphrases are generated into a fixed buffer per client, a buffer at a
+ * time as the client reads them, so no request holds up the others for long
+ * and nothing is left behind in freed memory.
+ *
+ * The socket is created accessible only to the user running the server, since
+ * anyone who can connect to it can read freshly generated passphrases.
+ */
+
+/* Needed for accept4 on linux. */
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include "diceware.h"
+#include "server.h"
+
+#ifdef __linux__
+
+/**
+ * Maximum number of events handled per call to \c epoll_wait.
+ */
+#define MAX_EVENTS 64
+
+/**
+ * Size of the output buffer of each client. Passphrases are generated into it
+ * a buffer at a time as the client reads them, so it must hold at least one of
+ * the longest passphrases a request may ask for, with room to spare.
+ */
+#define OUT_SIZE (4 * SERVER_MAX_WORDS * (DW_WORD_MAX + 1))
+
+/**
+ * State of a single connected client.
+ */
+struct client
+{
+    int fd;                         /**< Connected socket. */
+    struct client *prev, *next;     /**< Links in the list of all clients. */
+    char in[SERVER_REQUEST_MAX];    /**< Partial request data. */
+    size_t inlen;                   /**< Number of bytes in #in. */
+    char out[OUT_SIZE];             /**< Responses not yet sent. */
+    size_t outpos;                  /**< Bytes of #out already sent. */
+    size_t outlen;                  /**< Number of bytes in #out. */
+    char list[SERVER_REQUEST_MAX];  /**< List used by the request being
+                                         answered, or empty for the default
+                                         list. */
+    size_t nwords;                  /**< Words per passphrase of the request
+                                         being answered. */
+    size_t pending;                 /**< Passphrases of the request being
+                                         answered not yet generated. */
+    int eof;                        /**< The client closed its end. */
+};
+
+/**
+ * Set by the signal handler to ask the event loop to exit.
+ */
+static volatile sig_atomic_t _server_stop;
+
+static void _server_signal(int sig)
+{
+    (void)sig;
+    _server_stop = 1;
+}
+
+/**
+ * \brief Append \p len bytes of \p data to the pending output of \p c.
+ */
+static int _server_queue(struct client *c, const char *data, size_t len)
+{
+    if (len > sizeof(c->out) - c->outlen)
+    {
+        warnx("response too long");
+        return -1;
+    }
+
+    memcpy(c->out + c->outlen, data, len);
+    c->outlen += len;
+
+    return 0;
+}
+
+/**
+ * \brief Queue an error response for \p c.
+ */
+static int _server_error(struct client *c, const char *msg)
+{
+    char line[SERVER_REQUEST_MAX];
+    int len;
+
+    len = snprintf(line, sizeof(line), "ERR %s\n", msg);
+    return _server_queue(c, line, len);
+}
+
+/**
+ * \brief Parse the request \p line from \p c.
+ *
+ * The response is left for #_server_fill() to generate as the client reads
+ * it.
+ *
+ * \return Returns 0 if the request was answered, even with an error response,
+ * or -1 if the client must be dropped.
+ */
+static int _server_request(struct dw_cache *cache, struct client *c,
+        char *line)
+{
+    unsigned long nwords, count;
+    const char *list;
+    char *tok, *save, *endptr;
+    unsigned long *arg;
+
+    tok = strtok_r(line, " \t", &save);
+    if (tok == NULL || strcmp(tok, "GEN") != 0)
+    {
+        return _server_error(c, "unknown command");
+    }
+
+    nwords = 4;
+    count = 1;
+    list = "";
+    while ((tok = strtok_r(NULL, " \t", &save)) != NULL)
+    {
+        if (strncmp(tok, "list=", 5) == 0 && tok[5] != '\0')
+        {
+            list = tok + 5;
+            continue;
+        }
+        else if (strncmp(tok, "n=", 2) == 0)
+        {
+            arg = &nwords;
+            tok += 2;
+        }
+        else if (strncmp(tok, "count=", 6) == 0)
+        {
+            arg = &count;
+            tok += 6;
+        }
+        else
+        {
+            return _server_error(c, "unknown argument");
+        }
+
+        *arg = strtoul(tok, &endptr, 10);
+        if (*tok == '\0' || *endptr != '\0')
+        {
+            return _server_error(c, "invalid argument");
+        }
+    }
+
+    if (nwords == 0 || nwords > SERVER_MAX_WORDS || count == 0
+            || count > SERVER_MAX_REQUEST_WORDS / nwords)
+    {
+        return _server_error(c, "argument out of range");
+    }
+
+    if (dw_cache_get(cache, *list != '\0' ? list : NULL) == NULL)
+    {
+        return _server_error(c, "unknown word list");
+    }
+
+    /* The line is at most as long as the request buffer. */
+    strcpy(c->list, list);
+    c->nwords = nwords;
+    c->pending = count;
+
+    return 0;
+}
+
+/**
+ * \brief Generate as many of the passphrases still owed to \p c as fit in its
+ * output buffer, and queue them behind an <tt>OK n</tt> line.
+ *
+ * The status line is only written once the passphrases it announces are
+ * there, so if they cannot be generated the client is told so with an
+ * <tt>ERR</tt> line instead, and the rest of the request is dropped.
+ *
+ * \return Returns 0 on success, even with an error response, or -1 if the
+ * client must be dropped.
+ */
+static int _server_fill(struct dw_cache *cache, struct client *c)
+{
+    struct diceware *dw;
+    size_t room, most, n, len;
+    char header[32];
+    int hlen;
+
+    if (c->pending == 0)
+    {
+        return 0;
+    }
+
+    /* Move what is left to send to the front, and wipe the space it leaves
+     * behind.
+     */
+    if (c->outpos > 0)
+    {
+        memmove(c->out, c->out + c->outpos, c->outlen - c->outpos);
+        explicit_bzero(c->out + c->outlen - c->outpos, c->outpos);
+        c->outlen -= c->outpos;
+        c->outpos = 0;
+    }
+
+    /* Ask for no more passphrases than fit even if every word is as long as
+     * possible, leaving room for the status line in front of them and the NUL
+     * #dw_generate_mem() adds.
+     */
+    room = sizeof(c->out) - c->outlen;
+    most = c->nwords * (DW_WORD_MAX + 1) + 1;
+    n = room > sizeof(header) + most
+        ? (room - sizeof(header) - 1) / most : 0;
+    if (n > c->pending)
+    {
+        n = c->pending;
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    hlen = snprintf(header, sizeof(header), "OK %zu\n", n);
+    room -= hlen;
+
+    /* Look the list up again, since other requests may have evicted it. */
+    dw = dw_cache_get(cache, c->list[0] != '\0' ? c->list : NULL);
+    if (dw == NULL
+            || dw_generate_mem(dw, c->out + c->outlen + hlen, room, &len,
+                c->nwords, n) < 0)
+    {
+        c->pending = 0;
+        return _server_error(c, "generation failed");
+    }
+
+    memcpy(c->out + c->outlen, header, hlen);
+    c->outlen += hlen + len;
+    c->pending -= n;
+
+    return 0;
+}
+
+/**
+ * \brief Answer buffered requests from \p c, generate the next buffer of
+ * passphrases for it, and send as much pending output as the socket will
+ * take, then update the events we wait for on it.
+ *
+ * At most one buffer of passphrases is generated per call, so a client asking
+ * for many cannot hold up the others; the event loop calls back as soon as
+ * the socket has room for more.
+ *
+ * \return Returns 0 if the client is still active, or -1 if it should be
+ * closed.
+ */
+static int _server_pump(struct dw_cache *cache, int epfd, struct client *c)
+{
+    struct epoll_event ev;
+    char *nl;
+    size_t len;
+    ssize_t n;
+
+    /* Answer complete request lines once the previous request is done and
+     * there is room for a response line.
+     */
+    while (c->pending == 0 && sizeof(c->out) - c->outlen >= SERVER_REQUEST_MAX
+            && (nl = memchr(c->in, '\n', c->inlen)) != NULL)
+    {
+        *nl = '\0';
+        len = nl - c->in + 1;
+        if (nl > c->in && nl[-1] == '\r')
+        {
+            nl[-1] = '\0';
+        }
+
+        if (_server_request(cache, c, c->in) < 0)
+        {
+            return -1;
+        }
+
+        memmove(c->in, c->in + len, c->inlen - len);
+        c->inlen -= len;
+    }
+
+    /* A full buffer without a newline can never become a valid request. */
+    if (c->pending == 0 && c->inlen == sizeof(c->in)
+            && memchr(c->in, '\n', c->inlen) == NULL
+            && sizeof(c->out) - c->outlen >= SERVER_REQUEST_MAX)
+    {
+        _server_error(c, "request too long");
+        c->inlen = 0;
+        c->eof = 1;
+    }
+
+    if (_server_fill(cache, c) < 0)
+    {
+        return -1;
+    }
+
+    while (c->outpos < c->outlen)
+    {
+        n = send(c->fd, c->out + c->outpos, c->outlen - c->outpos,
+                MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            else if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        c->outpos += n;
+    }
+
+    /* The buffer holds passphrases; don't leave them around once sent. */
+    if (c->outpos == c->outlen)
+    {
+        explicit_bzero(c->out, c->outlen);
+        c->outpos = 0;
+        c->outlen = 0;
+    }
+
+    if (c->eof && c->outlen == 0 && c->pending == 0
+            && memchr(c->in, '\n', c->inlen) == NULL)
+    {
+        return -1;
+    }
+
+    /* Read more requests while there is room for them, and wait for room in
+     * the socket while there is something to send or more work to do.
+     */
+    ev.events = 0;
+    if (!c->eof && c->inlen < sizeof(c->in))
+    {
+        ev.events |= EPOLLIN;
+    }
+    if (c->outlen > 0 || c->pending > 0
+            || memchr(c->in, '\n', c->inlen) != NULL)
+    {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+    {
+        warn("epoll_ctl");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Read whatever \p c has sent and handle it.
+ *
+ * \return Returns 0 if the client is still active, or -1 if it should be
+ * closed.
+ */
+static int _server_read(struct dw_cache *cache, int epfd, struct client *c)
+{
+    ssize_t n;
+
+    while (!c->eof && c->inlen < sizeof(c->in))
+    {
+        n = recv(c->fd, c->in + c->inlen, sizeof(c->in) - c->inlen, 0);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            else if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        else if (n == 0)
+        {
+            c->eof = 1;
+        }
+        c->inlen += n;
+    }
+
+    return _server_pump(cache, epfd, c);
+}
+
+/**
+ * \brief Disconnect \p c and release everything it holds.
+ */
+static void _server_drop(struct client **clients, struct client *c)
+{
+    if (c->prev != NULL)
+    {
+        c->prev->next = c->next;
+    }
+    else
+    {
+        *clients = c->next;
+    }
+    if (c->next != NULL)
+    {
+        c->next->prev = c->prev;
+    }
+
+    close(c->fd);
+    explicit_bzero(c, sizeof(*c));
+    free(c);
+}
+
+/**
+ * \brief Accept all pending connections on \p lfd.
+ */
+static void _server_accept(int epfd, int lfd, struct client **clients)
+{
+    struct epoll_event ev;
+    struct client *c;
+    int fd;
+
+    for (;;)
+    {
+        fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                warn("accept4");
+            }
+            return;
+        }
+
+        c = calloc(1, sizeof(*c));
+        if (c == NULL)
+        {
+            warn("calloc");
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            warn("epoll_ctl");
+            close(fd);
+            free(c);
+            continue;
+        }
+
+        c->next = *clients;
+        if (*clients != NULL)
+        {
+            (*clients)->prev = c;
+        }
+        *clients = c;
+    }
+}
+
+/**
+ * \brief Create the listening socket at \p path.
+ */
+static int _server_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    mode_t mask;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        warnx("socket path too long: %s", path);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        warn("socket");
+        return -1;
+    }
+
+    /* Replace a socket left behind by an earlier server, but nothing else. */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(path);
+    }
+
+    /* Only the owner may connect and read passphrases. */
+    mask = umask(077);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        warn("bind(%s)", path);
+        umask(mask);
+        close(fd);
+        return -1;
+    }
+    umask(mask);
+
+    if (listen(fd, SOMAXCONN) < 0)
+    {
+        warn("listen(%s)", path);
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * \brief Serve passphrases on the Unix domain socket at \p path.
+ *
+ * Runs until interrupted by \c SIGINT or \c SIGTERM, then removes the socket.
+ *
+ * \param cache Word lists used for requests; requests without a \c list
+ * argument use its default list.
+ * \param path Path at which to create the socket.
+ *
+ * \return Returns 0 after a clean shutdown. On failure, prints an error message
+ * to stderr and returns -1.
+ */
+int server_run(struct dw_cache *cache, const char *path)
+{
+    struct epoll_event ev, events[MAX_EVENTS];
+    struct sigaction sa;
+    struct client *clients, *c;
+    int lfd, epfd, i, n, rc;
+
+    lfd = _server_listen(path);
+    if (lfd < 0)
+    {
+        return -1;
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+    {
+        warn("epoll_create1");
+        close(lfd);
+        unlink(path);
+        return -1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev) < 0)
+    {
+        warn("epoll_ctl");
+        close(epfd);
+        close(lfd);
+        unlink(path);
+        return -1;
+    }
+
+    /* Interrupt epoll_wait on a signal so the loop can exit cleanly. */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _server_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    clients = NULL;
+    rc = 0;
+    while (!_server_stop)
+    {
+        n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            warn("epoll_wait");
+            rc = -1;
+            break;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            c = events[i].data.ptr;
+            if (c == NULL)
+            {
+                _server_accept(epfd, lfd, &clients);
+            }
+            else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                if (_server_read(cache, epfd, c) < 0)
+                {
+                    _server_drop(&clients, c);
+                }
+            }
+            else if (_server_pump(cache, epfd, c) < 0)
+            {
+                _server_drop(&clients, c);
+            }
+        }
+    }
+
+    while (clients != NULL)
+    {
+        _server_drop(&clients, clients);
+    }
+
+    close(epfd);
+    close(lfd);
+    unlink(path);
+
+    return rc;
+}
+
+#else /* !__linux__ */
+
+int server_run(struct dw_cache *cache, const char *path)
+{
+    (void)cache;
+    (void)path;
+    warnx("server mode requires epoll, which is only available on linux");
+    return -1;
+}
+
+#endif /* __linux__ */
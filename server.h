@@ -0,0 +1,35 @@
+/**
+ * \file server.h
+ */
+
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+
+#include "diceware.h"
+
+/**
+ * Longest request line accepted by the server, including the newline.
+ */
+#define SERVER_REQUEST_MAX 256
+
+/**
+ * Largest number of words per passphrase a single request may ask for.
+ */
+#define SERVER_MAX_WORDS 256
+
+/**
+ * Largest number of words a single request may ask for, over all its
+ * passphrases. Larger batches take several requests.
+ */
+#define SERVER_MAX_REQUEST_WORDS 65536
+
+/**
+ * Number of named word lists the server keeps loaded besides its default list.
+ */
+#define SERVER_MAX_LISTS 8
+
+int server_run(struct dw_cache *cache, const char *path);
+
+
+#endif /* end of include guard: _SERVER_H_ */
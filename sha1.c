@@ -0,0 +1,133 @@
+/**
+ * \file sha1.c
+ *
+ * \brief SHA-1, as specified in FIPS 180-4.
+ *
+ * SHA-1 is only used to look passphrases up in breached password corpora,
+ * which are published as SHA-1 hashes; it is not relied on for security.
+ */
+
+#include <string.h>
+
+#include "sha1.h"
+
+/**
+ * Size of a SHA-1 message block in bytes.
+ */
+#define SHA1_BLOCK 64
+
+/**
+ * \brief Rotate \p x left by \p n bits.
+ */
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/**
+ * \brief Mix the 64-byte \p block into the hash state \p h.
+ */
+static void _sha1_block(uint32_t h[5], const uint8_t *block)
+{
+    uint32_t w[80], a, b, c, d, e, t;
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16
+            | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (i = 16; i < 80; i++)
+    {
+        t = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+        w[i] = ROL(t, 1);
+    }
+
+    a = h[0];
+    b = h[1];
+    c = h[2];
+    d = h[3];
+    e = h[4];
+
+/* One round: mix w[i] into the state with the round function f and the
+ * constant k, then rotate the state. */
+#define ROUND(f, k) \
+    do \
+    { \
+        t = ROL(a, 5) + (f) + e + (k) + w[i]; \
+        e = d; \
+        d = c; \
+        c = ROL(b, 30); \
+        b = a; \
+        a = t; \
+    } \
+    while (0)
+
+    for (i = 0; i < 20; i++)
+    {
+        ROUND((b & c) | (~b & d), 0x5a827999);
+    }
+    for (; i < 40; i++)
+    {
+        ROUND(b ^ c ^ d, 0x6ed9eba1);
+    }
+    for (; i < 60; i++)
+    {
+        ROUND((b & c) | (b & d) | (c & d), 0x8f1bbcdc);
+    }
+    for (; i < 80; i++)
+    {
+        ROUND(b ^ c ^ d, 0xca62c1d6);
+    }
+
+#undef ROUND
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+/**
+ * \brief Compute the SHA-1 digest of the \p len bytes at \p data.
+ *
+ * \param data Message to hash.
+ * \param len Length of \p data in bytes.
+ * \param digest Filled in with the digest.
+ */
+void sha1(const void *data, size_t len, uint8_t digest[SHA1_DIGEST_LENGTH])
+{
+    const uint8_t *p = data;
+    uint8_t tail[2 * SHA1_BLOCK];
+    uint32_t h[5] = {
+        0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+    };
+    uint64_t bits;
+    size_t i, rest, ntail;
+
+    for (rest = len; rest >= SHA1_BLOCK; rest -= SHA1_BLOCK, p += SHA1_BLOCK)
+    {
+        _sha1_block(h, p);
+    }
+
+    /* Pad with a one bit, zeros and the message length in bits. */
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, p, rest);
+    tail[rest] = 0x80;
+    ntail = rest + 9 <= SHA1_BLOCK ? SHA1_BLOCK : 2 * SHA1_BLOCK;
+    bits = (uint64_t)len * 8;
+    for (i = 0; i < 8; i++)
+    {
+        tail[ntail - 1 - i] = bits >> (8 * i);
+    }
+    for (i = 0; i < ntail; i += SHA1_BLOCK)
+    {
+        _sha1_block(h, tail + i);
+    }
+
+    for (i = 0; i < SHA1_DIGEST_LENGTH; i++)
+    {
+        digest[i] = h[i / 4] >> (24 - 8 * (i % 4));
+    }
+
+    /* The message may be a passphrase. */
+    explicit_bzero(tail, sizeof(tail));
+}
@@ -0,0 +1,20 @@
+/**
+ * \file sha1.h
+ */
+
+#ifndef _SHA1_H_
+#define _SHA1_H_
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Size of a SHA-1 digest in bytes.
+ */
+#define SHA1_DIGEST_LENGTH 20
+
+void sha1(const void *data, size_t len, uint8_t digest[SHA1_DIGEST_LENGTH]);
+
+
+#endif /* end of include guard: _SHA1_H_ */
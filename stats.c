@@ -0,0 +1,217 @@
+/**
+ * \file stats.c
+ *
+ * \brief Report the usage counters and timers kept in a diceware handle.
+ *
+ * The counters can be printed for a person to read, or written as a
+ * Prometheus text file for the node exporter's textfile collector. The text
+ * file is written next to its destination and renamed into place, so the
+ * collector never sees a partial file.
+ */
+
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+/**
+ * A counter exported to Prometheus.
+ */
+struct stats_counter
+{
+    const char *name;           /**< Metric name, without the prefix. */
+    const char *help;           /**< Description of the metric. */
+    uint64_t value;             /**< Current value. */
+};
+
+/**
+ * A phase whose time is exported to Prometheus.
+ */
+struct stats_phase
+{
+    const char *name;           /**< Value of the \c phase label. */
+    uint64_t ns;                /**< Time spent in the phase. */
+};
+
+/**
+ * \brief Print the counters and timers of \p dw to \p output.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int stats_print(const struct diceware *dw, FILE *output)
+{
+    int rc;
+
+    rc = fprintf(output,
+            "rng: %" PRIu64 " calls, %" PRIu64 " bytes in %.3f ms\n"
+            "lookups: %" PRIu64 " words\n"
+            "sqlite: %" PRIu64 " steps in %.3f ms, %" PRIu64 " busy retries "
+            "in %.3f ms\n"
+            "output: %" PRIu64 " bytes in %.3f ms\n"
+            "time: open %.3f ms, parse %.3f ms, insert %.3f ms, "
+            "generate %.3f ms\n",
+            dw->rng_calls, dw->rng_bytes, dw->rng_ns / 1e6,
+            dw->lookups,
+            dw->sql_steps, dw->sql_ns / 1e6, dw->sql_busy,
+            dw->busy_ns / 1e6,
+            dw->bytes_written, dw->write_ns / 1e6,
+            dw->open_ns / 1e6, dw->parse_ns / 1e6, dw->insert_ns / 1e6,
+            dw->generate_ns / 1e6);
+    if (rc >= 0 && dw->seen != NULL)
+    {
+        rc = fprintf(output, "unique: %" PRIu64 " collisions\n",
+                dw->collisions);
+    }
+    if (rc >= 0 && dw->deny != NULL)
+    {
+        rc = fprintf(output, "deny: %" PRIu64 " passphrases rejected\n",
+                dw->rejections);
+    }
+    if (rc >= 0 && dw->entropy >= 0)
+    {
+        rc = fprintf(output, "entropy: %.2f bits per passphrase of %zu "
+                "words\n", dw->entropy, dw->entropy_nwords);
+    }
+    if (rc < 0)
+    {
+        warn("fprintf");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Write the counters and timers of \p dw to \p output in the
+ * Prometheus text format.
+ */
+static int _stats_prometheus(const struct diceware *dw, FILE *output)
+{
+    const struct stats_counter counters[] =
+    {
+        {"rng_calls_total", "Calls made to the system RNG.", dw->rng_calls},
+        {"rng_bytes_total", "Random bytes fetched from the system RNG.",
+            dw->rng_bytes},
+        {"lookups_total", "Words looked up.", dw->lookups},
+        {"sqlite_steps_total", "SQLite statement steps.", dw->sql_steps},
+        {"sqlite_busy_retries_total", "Retries after SQLITE_BUSY.",
+            dw->sql_busy},
+        {"written_bytes_total", "Bytes of passphrases written.",
+            dw->bytes_written},
+        {"unique_collisions_total", "Passphrases drawn again because they "
+            "were already generated.", dw->collisions},
+        {"deny_rejections_total", "Passphrases drawn again because they "
+            "were in the deny list.", dw->rejections},
+    };
+    const struct stats_phase phases[] =
+    {
+        {"open", dw->open_ns},
+        {"parse", dw->parse_ns},
+        {"insert", dw->insert_ns},
+        {"rng", dw->rng_ns},
+        {"sqlite", dw->sql_ns},
+        {"busy_wait", dw->busy_ns},
+        {"write", dw->write_ns},
+        {"generate", dw->generate_ns},
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++)
+    {
+        if (fprintf(output, "# HELP diceware_%s %s\n"
+                    "# TYPE diceware_%s counter\n"
+                    "diceware_%s %" PRIu64 "\n", counters[i].name,
+                    counters[i].help, counters[i].name, counters[i].name,
+                    counters[i].value) < 0)
+        {
+            return -1;
+        }
+    }
+
+    if (fprintf(output, "# HELP diceware_phase_seconds_total Time spent in "
+                "each phase.\n"
+                "# TYPE diceware_phase_seconds_total counter\n") < 0)
+    {
+        return -1;
+    }
+    for (i = 0; i < sizeof(phases) / sizeof(phases[0]); i++)
+    {
+        if (fprintf(output, "diceware_phase_seconds_total{phase=\"%s\"} "
+                    "%.9f\n", phases[i].name, phases[i].ns / 1e9) < 0)
+        {
+            return -1;
+        }
+    }
+
+    /* Only known once passphrases have been generated. */
+    if (dw->entropy >= 0 && fprintf(output,
+                "# HELP diceware_passphrase_entropy_bits Entropy of each "
+                "passphrase generated.\n"
+                "# TYPE diceware_passphrase_entropy_bits gauge\n"
+                "diceware_passphrase_entropy_bits %.6f\n"
+                "# HELP diceware_passphrase_words Words in each passphrase "
+                "generated.\n"
+                "# TYPE diceware_passphrase_words gauge\n"
+                "diceware_passphrase_words %zu\n",
+                dw->entropy, dw->entropy_nwords) < 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Write the counters and timers of \p dw to \p path as a Prometheus
+ * text file.
+ *
+ * \return Returns 0 on success. On failure, prints an error message to stderr
+ * and returns -1.
+ */
+int stats_write_prometheus(const struct diceware *dw, const char *path)
+{
+    char tmp[4096];
+    FILE *output;
+    int rc;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+    {
+        warnx("path too long: %s", path);
+        return -1;
+    }
+
+    output = fopen(tmp, "w");
+    if (output == NULL)
+    {
+        warn("fopen(%s)", tmp);
+        return -1;
+    }
+
+    rc = _stats_prometheus(dw, output);
+    if (rc < 0)
+    {
+        warn("fprintf(%s)", tmp);
+    }
+
+    if (fclose(output) != 0 && rc == 0)
+    {
+        warn("fclose(%s)", tmp);
+        rc = -1;
+    }
+
+    if (rc == 0 && rename(tmp, path) < 0)
+    {
+        warn("rename(%s)", path);
+        rc = -1;
+    }
+
+    if (rc < 0)
+    {
+        unlink(tmp);
+    }
+
+    return rc;
+}
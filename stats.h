@@ -0,0 +1,17 @@
+/**
+ * \file stats.h
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+
+#include <stdio.h>
+
+#include "diceware.h"
+
+int stats_print(const struct diceware *dw, FILE *output);
+int stats_write_prometheus(const struct diceware *dw, const char *path);
+
+
+#endif /* end of include guard: _STATS_H_ */